@@ -0,0 +1,437 @@
+#include "BVH.h"
+
+#include <array>
+#include <execution>
+#include <future>
+#include <numeric>
+#include <thread>
+
+namespace
+{
+	// nodes with fewer primitives are binned and partitioned on a single thread
+	constexpr uint32_t ParallelPrimitiveThreshold = 1 << 16;
+	// subtrees with fewer primitives are not handed to another thread
+	constexpr uint32_t TaskPrimitiveThreshold = 1 << 12;
+
+	struct NodeInfo
+	{
+		Bounds3f Bounds;
+		Bounds3f CentroidBounds;
+	};
+
+	struct Bins
+	{
+		Bounds3f Bounds[BVH::BinCount];
+		uint32_t Count[BVH::BinCount] = {};
+	};
+
+	// Runs fn(chunk, chunkBegin, chunkEnd) over equally sized chunks of [begin, end), in parallel when chunkCount > 1
+	template<typename ChunkFn>
+	void ForEachChunk(uint32_t begin, uint32_t end, uint32_t chunkCount, ChunkFn&& fn)
+	{
+		if (chunkCount <= 1) {
+			fn(0, begin, end);
+			return;
+		}
+
+		std::vector<uint32_t> chunks(chunkCount);
+		std::iota(chunks.begin(), chunks.end(), 0);
+		uint64_t count = end - begin;
+		std::for_each(std::execution::par, chunks.begin(), chunks.end(), [&](uint32_t chunk) {
+				fn(chunk, begin + (uint32_t)(count * chunk / chunkCount), begin + (uint32_t)(count * (chunk + 1) / chunkCount));
+				});
+	}
+
+	// Stable LSD radix sort on bits [firstBit, lastBit) of the keys, 8 bits per pass. Every chunk histograms and
+	// scatters its own range, offsets are laid out digit major and chunk minor so equal digits keep their order.
+	void RadixSort(std::vector<uint64_t>& keys, int firstBit, int lastBit, uint32_t chunkCount)
+	{
+		constexpr int RadixBits = 8;
+		constexpr int RadixSize = 1 << RadixBits;
+
+		std::vector<uint64_t> scratch(keys.size());
+		std::vector<std::array<uint32_t, RadixSize>> histograms(chunkCount);
+		uint32_t count = (uint32_t)keys.size();
+
+		for (int shift = firstBit; shift < lastBit; shift += RadixBits) {
+			ForEachChunk(0, count, chunkCount, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd) {
+					std::array<uint32_t, RadixSize>& histogram = histograms[chunk];
+					histogram.fill(0);
+					for (uint32_t i = chunkBegin; i < chunkEnd; i++)
+						histogram[(keys[i] >> shift) & (RadixSize - 1)]++;
+					});
+
+			uint32_t offset = 0;
+			for (int digit = 0; digit < RadixSize; digit++) {
+				for (auto& histogram : histograms) {
+					uint32_t digitCount = histogram[digit];
+					histogram[digit] = offset;
+					offset += digitCount;
+				}
+			}
+
+			ForEachChunk(0, count, chunkCount, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd) {
+					std::array<uint32_t, RadixSize>& histogram = histograms[chunk];
+					for (uint32_t i = chunkBegin; i < chunkEnd; i++)
+						scratch[histogram[(keys[i] >> shift) & (RadixSize - 1)]++] = keys[i];
+					});
+
+			keys.swap(scratch);
+		}
+	}
+}
+
+void BVH::Build(const std::vector<Bounds3f>& primitiveBounds, BVHBuildMode mode, unsigned int threadCount, uint32_t packetWidth)
+{
+	Nodes.clear();
+	m_Parents.clear();
+	m_PrimitiveLeaves.clear();
+	PrimitiveIndices.resize(primitiveBounds.size());
+	std::iota(PrimitiveIndices.begin(), PrimitiveIndices.end(), 0);
+
+	if (primitiveBounds.empty())
+		return;
+
+	m_PacketWidth = std::max(1u, packetWidth);
+	m_MaxLeafPrimitives = std::max<uint32_t>(MaxLeafPrimitives, m_PacketWidth);
+	m_ThreadCount = threadCount ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+	// a few more tasks than threads so uneven splits still keep every core busy
+	m_MaxTaskDepth = m_ThreadCount > 1 ? Utils::Log2Int(Utils::RoundUpPow2(m_ThreadCount)) + 2 : 0;
+
+	m_PrimitiveBounds = &primitiveBounds;
+	m_Centroids.resize(primitiveBounds.size());
+	std::transform(std::execution::par_unseq, primitiveBounds.begin(), primitiveBounds.end(), m_Centroids.begin(),
+			[](const Bounds3f& b) { return b.Center(); });
+
+	// a binary tree never has more than 2n - 1 nodes
+	Nodes.reserve(2 * primitiveBounds.size() - 1);
+	if (mode == BVHBuildMode::Linear)
+		BuildLinear();
+	else
+		BuildRecursive(Nodes, 0, (uint32_t)primitiveBounds.size(), 0);
+	Nodes.shrink_to_fit();
+
+	m_PrimitiveBounds = nullptr;
+	m_Centroids.clear();
+	m_Centroids.shrink_to_fit();
+	m_LinearSplits.clear();
+	m_LinearSplits.shrink_to_fit();
+
+	m_WeightedArea = 0.0f;
+	for (const BVHNode& node : Nodes)
+		m_WeightedArea += node.Bounds.SurfaceArea() * GetNodeCost(node);
+	m_BuildCost = m_WeightedArea / Nodes[0].Bounds.SurfaceArea();
+}
+
+float BVH::GetCostRatio() const
+{
+	if (Nodes.empty() || m_BuildCost <= 0.0f)
+		return 1.0f;
+	return (m_WeightedArea / Nodes[0].Bounds.SurfaceArea()) / m_BuildCost;
+}
+
+void BVH::BuildRefitLinks()
+{
+	m_Parents.resize(Nodes.size());
+	m_PrimitiveLeaves.resize(PrimitiveIndices.size());
+	for (uint32_t i = 0; i < (uint32_t)Nodes.size(); i++) {
+		const BVHNode& node = Nodes[i];
+		if (node.PrimitiveCount > 0) {
+			for (uint32_t j = 0; j < node.PrimitiveCount; j++)
+				m_PrimitiveLeaves[PrimitiveIndices[node.Offset + j]] = i;
+		} else {
+			m_Parents[i + 1] = i;
+			m_Parents[node.Offset] = i;
+		}
+	}
+}
+
+void BVH::BuildRecursive(std::vector<BVHNode>& nodes, uint32_t begin, uint32_t end, int depth)
+{
+	const std::vector<Bounds3f>& primitiveBounds = *m_PrimitiveBounds;
+
+	uint32_t nodeIndex = (uint32_t)nodes.size();
+	nodes.emplace_back();
+
+	uint32_t count = end - begin;
+	// min/max unions and integer counts are exact, so chunking never changes the result
+	uint32_t chunkCount = count >= ParallelPrimitiveThreshold ? m_ThreadCount : 1;
+
+	std::vector<NodeInfo> chunkInfo(chunkCount);
+	ForEachChunk(begin, end, chunkCount, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd) {
+			NodeInfo& info = chunkInfo[chunk];
+			for (uint32_t i = chunkBegin; i < chunkEnd; i++) {
+				uint32_t prim = PrimitiveIndices[i];
+				info.Bounds = Union(info.Bounds, primitiveBounds[prim]);
+				info.CentroidBounds = Union(info.CentroidBounds, m_Centroids[prim]);
+			}
+			});
+
+	Bounds3f bounds, centroidBounds;
+	for (const NodeInfo& info : chunkInfo) {
+		bounds = Union(bounds, info.Bounds);
+		centroidBounds = Union(centroidBounds, info.CentroidBounds);
+	}
+	nodes[nodeIndex].Bounds = bounds;
+
+	int axis = centroidBounds.MaximumExtent();
+	float axisMin = centroidBounds.pMin[axis];
+	float axisExtent = centroidBounds.pMax[axis] - axisMin;
+
+	auto makeLeaf = [&]() {
+		nodes[nodeIndex].Offset = begin;
+		nodes[nodeIndex].PrimitiveCount = count;
+	};
+
+	// nothing left to split, either a single primitive, coincident centroids or a too deep tree
+	if (count == 1 || axisExtent <= 0.0f || depth >= MaxDepth) {
+		makeLeaf();
+		return;
+	}
+
+	auto binIndex = [&](uint32_t prim) {
+		int b = (int)(BinCount * ((m_Centroids[prim][axis] - axisMin) / axisExtent));
+		return std::min(b, BinCount - 1);
+	};
+
+	std::vector<Bins> chunkBins(chunkCount);
+	ForEachChunk(begin, end, chunkCount, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd) {
+			Bins& bins = chunkBins[chunk];
+			for (uint32_t i = chunkBegin; i < chunkEnd; i++) {
+				uint32_t prim = PrimitiveIndices[i];
+				int b = binIndex(prim);
+				bins.Bounds[b] = Union(bins.Bounds[b], primitiveBounds[prim]);
+				bins.Count[b]++;
+			}
+			});
+
+	Bins bins;
+	for (const Bins& chunk : chunkBins) {
+		for (int i = 0; i < BinCount; i++) {
+			bins.Bounds[i] = Union(bins.Bounds[i], chunk.Bounds[i]);
+			bins.Count[i] += chunk.Count[i];
+		}
+	}
+
+	// sweep from the right to get the cost of everything right of each split plane,
+	// then from the left to finish the cost of each candidate
+	float rightArea[BinCount - 1];
+	uint32_t rightCount[BinCount - 1];
+	Bounds3f accumulated;
+	uint32_t accumulatedCount = 0;
+	for (int i = BinCount - 1; i > 0; i--) {
+		accumulated = Union(accumulated, bins.Bounds[i]);
+		accumulatedCount += bins.Count[i];
+		rightArea[i - 1] = accumulatedCount ? accumulated.SurfaceArea() : 0.0f;
+		rightCount[i - 1] = accumulatedCount;
+	}
+
+	int bestSplit = -1;
+	float bestCost = std::numeric_limits<float>::max();
+	accumulated = Bounds3f();
+	accumulatedCount = 0;
+	for (int i = 0; i < BinCount - 1; i++) {
+		accumulated = Union(accumulated, bins.Bounds[i]);
+		accumulatedCount += bins.Count[i];
+		if (accumulatedCount == 0 || rightCount[i] == 0)
+			continue;
+
+		float cost = accumulatedCount * accumulated.SurfaceArea() + rightCount[i] * rightArea[i];
+		if (cost < bestCost) {
+			bestCost = cost;
+			bestSplit = i;
+		}
+	}
+
+	float leafCost = GetLeafCost(count);
+	float splitCost = TraversalCost + bestCost / bounds.SurfaceArea();
+	if (bestSplit < 0 || (count <= m_MaxLeafPrimitives && leafCost <= splitCost)) {
+		makeLeaf();
+		return;
+	}
+
+	// stable partition, so the primitive order (and with it the tree) is the same however it was chunked
+	uint32_t mid;
+	if (chunkCount == 1) {
+		auto midIter = std::stable_partition(PrimitiveIndices.begin() + begin, PrimitiveIndices.begin() + end,
+				[&](uint32_t prim) { return binIndex(prim) <= bestSplit; });
+		mid = (uint32_t)(midIter - PrimitiveIndices.begin());
+	} else {
+		std::vector<uint32_t> leftCounts(chunkCount, 0);
+		ForEachChunk(begin, end, chunkCount, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd) {
+				for (uint32_t i = chunkBegin; i < chunkEnd; i++)
+					leftCounts[chunk] += binIndex(PrimitiveIndices[i]) <= bestSplit;
+				});
+
+		uint32_t leftTotal = std::accumulate(leftCounts.begin(), leftCounts.end(), 0u);
+		std::vector<uint32_t> partitioned(count);
+		std::vector<uint32_t> leftBefore(chunkCount, 0);
+		std::exclusive_scan(leftCounts.begin(), leftCounts.end(), leftBefore.begin(), 0u);
+
+		ForEachChunk(begin, end, chunkCount, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd) {
+				uint32_t left = leftBefore[chunk];
+				uint32_t right = leftTotal + (chunkBegin - begin) - leftBefore[chunk];
+				for (uint32_t i = chunkBegin; i < chunkEnd; i++) {
+					uint32_t prim = PrimitiveIndices[i];
+					if (binIndex(prim) <= bestSplit)
+						partitioned[left++] = prim;
+					else
+						partitioned[right++] = prim;
+				}
+				});
+
+		std::copy(std::execution::par_unseq, partitioned.begin(), partitioned.end(), PrimitiveIndices.begin() + begin);
+		mid = begin + leftTotal;
+	}
+
+	nodes[nodeIndex].PrimitiveCount = 0;
+
+	if (depth < m_MaxTaskDepth && count >= TaskPrimitiveThreshold) {
+		// build the right subtree on another thread into its own array, then splice it in after the left one
+		// exactly where the serial build would have put it
+		std::vector<BVHNode> rightNodes;
+		auto rightTask = std::async(std::launch::async, [&]() {
+				rightNodes.reserve(2 * (end - mid) - 1);
+				BuildRecursive(rightNodes, mid, end, depth + 1);
+				});
+
+		BuildRecursive(nodes, begin, mid, depth + 1);
+		rightTask.get();
+
+		uint32_t rightBase = (uint32_t)nodes.size();
+		nodes[nodeIndex].Offset = rightBase;
+		for (BVHNode node : rightNodes) {
+			if (node.PrimitiveCount == 0)
+				node.Offset += rightBase;
+			nodes.push_back(node);
+		}
+	} else {
+		BuildRecursive(nodes, begin, mid, depth + 1);
+		nodes[nodeIndex].Offset = (uint32_t)nodes.size();
+		BuildRecursive(nodes, mid, end, depth + 1);
+	}
+}
+
+void BVH::BuildLinear()
+{
+	uint32_t count = (uint32_t)m_Centroids.size();
+	uint32_t chunkCount = count >= ParallelPrimitiveThreshold ? m_ThreadCount : 1;
+
+	std::vector<Bounds3f> chunkBounds(chunkCount);
+	ForEachChunk(0, count, chunkCount, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd) {
+			for (uint32_t i = chunkBegin; i < chunkEnd; i++)
+				chunkBounds[chunk] = Union(chunkBounds[chunk], m_Centroids[i]);
+			});
+
+	Bounds3f centroidBounds;
+	for (const Bounds3f& bounds : chunkBounds)
+		centroidBounds = Union(centroidBounds, bounds);
+
+	// Morton code in the upper half and primitive index in the lower half, so every key is unique
+	// and primitives sharing a code still get a well defined hierarchy
+	std::vector<uint64_t> keys(count);
+	ForEachChunk(0, count, chunkCount, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd) {
+			for (uint32_t i = chunkBegin; i < chunkEnd; i++)
+				keys[i] = ((uint64_t)Utils::EncodeMorton3(centroidBounds.Offset(m_Centroids[i])) << 32) | i;
+			});
+
+	RadixSort(keys, 32, 62, chunkCount);
+
+	for (uint32_t i = 0; i < count; i++)
+		PrimitiveIndices[i] = (uint32_t)keys[i];
+
+	// Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees" (2012):
+	// internal node i covers a key range with i at one end, so every node finds its range and split independently
+	auto delta = [&](int64_t i, int64_t j) {
+		if (j < 0 || j >= (int64_t)count)
+			return -1;
+		return Utils::CountLeadingZeros64(keys[i] ^ keys[j]);
+	};
+
+	m_LinearSplits.resize(count - 1);
+	ForEachChunk(0, count - 1, chunkCount, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd) {
+			for (int64_t i = chunkBegin; i < chunkEnd; i++) {
+				// direction of the range and the prefix length it must exceed
+				int64_t d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+				int deltaMin = delta(i, i - d);
+
+				int64_t lengthMax = 2;
+				while (delta(i, i + lengthMax * d) > deltaMin)
+					lengthMax *= 2;
+
+				int64_t length = 0;
+				for (int64_t t = lengthMax / 2; t >= 1; t /= 2) {
+					if (delta(i, i + (length + t) * d) > deltaMin)
+						length += t;
+				}
+
+				int64_t j = i + length * d;
+				int deltaNode = delta(i, j);
+
+				// binary search for the highest differing bit inside the range
+				int64_t split = 0;
+				int64_t t = length;
+				do {
+					t = (t + 1) / 2;
+					if (delta(i, i + (split + t) * d) > deltaNode)
+						split += t;
+				} while (t > 1);
+
+				m_LinearSplits[i] = (uint32_t)(i + split * d + std::min<int64_t>(d, 0));
+			}
+			});
+
+	EmitLinear(Nodes, 0, 0, count - 1, 0);
+}
+
+void BVH::EmitLinear(std::vector<BVHNode>& nodes, uint32_t internalNode, uint32_t first, uint32_t last, int depth)
+{
+	uint32_t nodeIndex = (uint32_t)nodes.size();
+	nodes.emplace_back();
+
+	uint32_t count = last - first + 1;
+	if (count <= m_MaxLeafPrimitives || depth >= MaxDepth) {
+		const std::vector<Bounds3f>& primitiveBounds = *m_PrimitiveBounds;
+		Bounds3f bounds;
+		for (uint32_t i = first; i <= last; i++)
+			bounds = Union(bounds, primitiveBounds[PrimitiveIndices[i]]);
+
+		nodes[nodeIndex].Bounds = bounds;
+		nodes[nodeIndex].Offset = first;
+		nodes[nodeIndex].PrimitiveCount = count;
+		return;
+	}
+
+	// the left child is the internal node ending at the split, the right one the node starting after it
+	uint32_t split = m_LinearSplits[internalNode];
+	nodes[nodeIndex].PrimitiveCount = 0;
+
+	Bounds3f rightBounds;
+	if (depth < m_MaxTaskDepth && count >= TaskPrimitiveThreshold) {
+		std::vector<BVHNode> rightNodes;
+		auto rightTask = std::async(std::launch::async, [&]() {
+				rightNodes.reserve(2 * (last - split) - 1);
+				EmitLinear(rightNodes, split + 1, split + 1, last, depth + 1);
+				});
+
+		EmitLinear(nodes, split, first, split, depth + 1);
+		rightTask.get();
+
+		uint32_t rightBase = (uint32_t)nodes.size();
+		nodes[nodeIndex].Offset = rightBase;
+		rightBounds = rightNodes[0].Bounds;
+		for (BVHNode node : rightNodes) {
+			if (node.PrimitiveCount == 0)
+				node.Offset += rightBase;
+			nodes.push_back(node);
+		}
+	} else {
+		EmitLinear(nodes, split, first, split, depth + 1);
+		nodes[nodeIndex].Offset = (uint32_t)nodes.size();
+		EmitLinear(nodes, split + 1, split + 1, last, depth + 1);
+		rightBounds = nodes[nodes[nodeIndex].Offset].Bounds;
+	}
+
+	// bounds are emitted bottom up once both children are done
+	nodes[nodeIndex].Bounds = Union(nodes[nodeIndex + 1].Bounds, rightBounds);
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#include "RayTracer.h"
+#include "Ray.h"
+#include "Objects/BoundingBox.h"
+#include "Accel/RayPacket.h"
+
+// Flattened node, stored depth first so the first child of an interior node directly follows it
+struct BVHNode
+{
+	Bounds3f Bounds;
+	uint32_t Offset; // first primitive for leaves, second child for interior nodes
+	uint32_t PrimitiveCount; // 0 for interior nodes
+};
+
+enum class BVHBuildMode
+{
+	SAH, // binned surface area heuristic, best traversal speed
+	Linear // Morton code ordering (LBVH), builds an order of magnitude faster for interactive edits
+};
+
+// Bounding volume hierarchy over an arbitrary set of primitives described only by their bounds.
+// The owner keeps the primitives and is handed their index back during traversal.
+class BVH
+{
+public:
+	static constexpr int BinCount = 12;
+	static constexpr int MaxLeafPrimitives = 4;
+	static constexpr int MaxDepth = 64;
+	// relative to the cost of intersecting one primitive
+	static constexpr float TraversalCost = 0.125f;
+
+	// The work is split across threadCount threads (0 uses every core, 1 builds serially);
+	// the resulting tree does not depend on the thread count.
+	// When leaf primitives are tested packetWidth at a time, leaves may hold up to that many and cost one test
+	// per started packet instead of one per primitive.
+	void Build(const std::vector<Bounds3f>& primitiveBounds, BVHBuildMode mode = BVHBuildMode::SAH, unsigned int threadCount = 0,
+			uint32_t packetWidth = 1);
+
+	// Closest hit traversal, nearest child first. hitLeaf(first, count, tMin, tMax, hitDistance) is called for every
+	// candidate leaf, it tests the primitives PrimitiveIndices[first, first + count) and returns whether one of them
+	// is hit closer than tMax, at hitDistance. tMax shrinks as closer hits are found, culling nodes behind them.
+	template<typename HitFn>
+	bool Intersect(const Ray& r, float tMin, float& tMax, HitFn&& hitLeaf) const;
+
+	// Any hit traversal for visibility, in no particular order. occludedLeaf(first, count, tMin, tMax) returns
+	// whether any of the primitives PrimitiveIndices[first, first + count) is hit in (tMin, tMax), the first leaf
+	// that is ends the traversal.
+	template<typename OccludedFn>
+	bool Occluded(const Ray& r, float tMin, float tMax, OccludedFn&& occludedLeaf) const;
+
+	// Closest hit traversal of the rays in rayMask of a coherent packet, starting at origin rather than packet.Origin.
+	// Nodes are culled for the whole packet with interval arithmetic, at the leaves every ray still in the mask is
+	// tested against the leaf bounds first. hitLeaf(first, count, rays) tests the primitives of a leaf against those
+	// rays, lowers their packet.TMax and returns the mask of rays it found closer hits for; so does this.
+	template<typename LeafFn>
+	uint64_t IntersectPacket(const glm::vec3& origin, RayPacket& packet, float tMin, uint64_t rayMask, LeafFn&& hitLeaf) const;
+
+	// Bottom up refit of the leaf holding primitive and of its ancestors, after that primitive changed.
+	// primitiveBounds(index) returns the current bounds of a primitive.
+	template<typename BoundsFn>
+	void Refit(uint32_t primitive, BoundsFn&& primitiveBounds);
+
+	// Surface area heuristic cost of the tree as it is now, against its cost right after it was built.
+	// Refits only grow this, a rebuild is worth it once it gets too large.
+	float GetCostRatio() const;
+
+	bool Empty() const { return Nodes.empty(); }
+	const Bounds3f& GetBounds() const { return Nodes[0].Bounds; }
+
+	std::vector<BVHNode> Nodes;
+	std::vector<uint32_t> PrimitiveIndices; // primitives referenced by the leaves, in leaf order
+
+private:
+	void BuildRecursive(std::vector<BVHNode>& nodes, uint32_t begin, uint32_t end, int depth);
+
+	// Linear build: PrimitiveIndices sorted by Morton code, m_LinearSplits holds the split of every internal node
+	void BuildLinear();
+	void EmitLinear(std::vector<BVHNode>& nodes, uint32_t internalNode, uint32_t first, uint32_t last, int depth);
+
+	void BuildRefitLinks();
+
+	float GetLeafCost(uint32_t count) const { return (float)((count + m_PacketWidth - 1) / m_PacketWidth); }
+	float GetNodeCost(const BVHNode& node) const { return node.PrimitiveCount > 0 ? GetLeafCost(node.PrimitiveCount) : TraversalCost; }
+
+	const std::vector<Bounds3f>* m_PrimitiveBounds = nullptr;
+	std::vector<glm::vec3> m_Centroids;
+	std::vector<uint32_t> m_LinearSplits;
+	unsigned int m_ThreadCount = 1;
+	int m_MaxTaskDepth = 0;
+	uint32_t m_PacketWidth = 1;
+	uint32_t m_MaxLeafPrimitives = MaxLeafPrimitives;
+
+	// only set up once the tree is first refit
+	std::vector<uint32_t> m_Parents;
+	std::vector<uint32_t> m_PrimitiveLeaves;
+
+	// sum of node surface areas weighted by their traversal or intersection cost, kept up to date by Refit
+	float m_WeightedArea = 0.0f;
+	float m_BuildCost = 0.0f;
+};
+
+template<typename BoundsFn>
+void BVH::Refit(uint32_t primitive, BoundsFn&& primitiveBounds)
+{
+	if (m_Parents.empty())
+		BuildRefitLinks();
+
+	uint32_t nodeIndex = m_PrimitiveLeaves[primitive];
+	while (true) {
+		BVHNode& node = Nodes[nodeIndex];
+
+		Bounds3f bounds;
+		if (node.PrimitiveCount > 0) {
+			for (uint32_t i = 0; i < node.PrimitiveCount; i++)
+				bounds = Union(bounds, primitiveBounds(PrimitiveIndices[node.Offset + i]));
+		} else {
+			bounds = Union(Nodes[nodeIndex + 1].Bounds, Nodes[node.Offset].Bounds);
+		}
+
+		// nothing above changes either
+		if (bounds.pMin == node.Bounds.pMin && bounds.pMax == node.Bounds.pMax)
+			break;
+
+		float weight = GetNodeCost(node);
+		m_WeightedArea += (bounds.SurfaceArea() - node.Bounds.SurfaceArea()) * weight;
+		node.Bounds = bounds;
+
+		if (nodeIndex == 0)
+			break;
+		nodeIndex = m_Parents[nodeIndex];
+	}
+}
+
+template<typename HitFn>
+bool BVH::Intersect(const Ray& r, float tMin, float& tMax, HitFn&& hitLeaf) const
+{
+	if (Nodes.empty())
+		return false;
+
+	const glm::vec3 invDir = 1.0f / r.Direction;
+
+	struct StackEntry
+	{
+		uint32_t Node;
+		float Distance;
+	};
+	StackEntry stack[MaxDepth + 1];
+	int stackSize = 0;
+
+	float rootDistance;
+	if (!Nodes[0].Bounds.IntersectP(r.Origin, invDir, tMin, tMax, rootDistance))
+		return false;
+	stack[stackSize++] = { 0, rootDistance };
+
+	bool hit = false;
+	while (stackSize > 0) {
+		const StackEntry entry = stack[--stackSize];
+		// a closer hit may have been found after this node was pushed
+		if (entry.Distance > tMax)
+			continue;
+
+		const BVHNode& node = Nodes[entry.Node];
+		if (node.PrimitiveCount > 0) {
+			float hitDistance;
+			if (hitLeaf(node.Offset, node.PrimitiveCount, tMin, tMax, hitDistance)) {
+				tMax = hitDistance;
+				hit = true;
+			}
+			continue;
+		}
+
+		uint32_t nearChild = entry.Node + 1;
+		uint32_t farChild = node.Offset;
+		float nearDistance, farDistance;
+		bool hitNear = Nodes[nearChild].Bounds.IntersectP(r.Origin, invDir, tMin, tMax, nearDistance);
+		bool hitFar = Nodes[farChild].Bounds.IntersectP(r.Origin, invDir, tMin, tMax, farDistance);
+
+		if (hitNear && hitFar) {
+			if (farDistance < nearDistance) {
+				std::swap(nearChild, farChild);
+				std::swap(nearDistance, farDistance);
+			}
+			// push the far child first so the near one is visited next
+			stack[stackSize++] = { farChild, farDistance };
+			stack[stackSize++] = { nearChild, nearDistance };
+		} else if (hitNear) {
+			stack[stackSize++] = { nearChild, nearDistance };
+		} else if (hitFar) {
+			stack[stackSize++] = { farChild, farDistance };
+		}
+	}
+
+	return hit;
+}
+
+template<typename OccludedFn>
+bool BVH::Occluded(const Ray& r, float tMin, float tMax, OccludedFn&& occludedLeaf) const
+{
+	if (Nodes.empty())
+		return false;
+
+	const glm::vec3 invDir = 1.0f / r.Direction;
+
+	uint32_t stack[MaxDepth + 1];
+	int stackSize = 0;
+	float distance;
+	if (!Nodes[0].Bounds.IntersectP(r.Origin, invDir, tMin, tMax, distance))
+		return false;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		uint32_t nodeIndex = stack[--stackSize];
+		const BVHNode& node = Nodes[nodeIndex];
+		if (node.PrimitiveCount > 0) {
+			if (occludedLeaf(node.Offset, node.PrimitiveCount, tMin, tMax))
+				return true;
+			continue;
+		}
+
+		if (Nodes[node.Offset].Bounds.IntersectP(r.Origin, invDir, tMin, tMax, distance))
+			stack[stackSize++] = node.Offset;
+		if (Nodes[nodeIndex + 1].Bounds.IntersectP(r.Origin, invDir, tMin, tMax, distance))
+			stack[stackSize++] = nodeIndex + 1;
+	}
+
+	return false;
+}
+
+template<typename LeafFn>
+uint64_t BVH::IntersectPacket(const glm::vec3& origin, RayPacket& packet, float tMin, uint64_t rayMask, LeafFn&& hitLeaf) const
+{
+	if (Nodes.empty() || rayMask == 0)
+		return 0;
+
+	struct StackEntry
+	{
+		uint32_t Node;
+		float Distance;
+	};
+	StackEntry stack[MaxDepth + 1];
+	int stackSize = 0;
+
+	float maxT = packet.GetMaxT(rayMask);
+	float rootDistance;
+	if (!packet.IntersectInterval(Nodes[0].Bounds, origin, tMin, maxT, rootDistance))
+		return 0;
+	stack[stackSize++] = { 0, rootDistance };
+
+	uint64_t hits = 0;
+	while (stackSize > 0) {
+		const StackEntry entry = stack[--stackSize];
+		// every ray may have found a closer hit after this node was pushed
+		if (entry.Distance > maxT)
+			continue;
+
+		const BVHNode& node = Nodes[entry.Node];
+		if (node.PrimitiveCount > 0) {
+			uint64_t rays = 0;
+			for (uint64_t mask = rayMask; mask; mask &= mask - 1) {
+				int i = Utils::CountTrailingZeros64(mask);
+				float distance;
+				if (node.Bounds.IntersectP(origin, packet.InvDirections[i], tMin, packet.TMax[i], distance))
+					rays |= 1ull << i;
+			}
+			uint64_t leafHits = rays ? hitLeaf(node.Offset, node.PrimitiveCount, rays) : 0;
+			if (leafHits) {
+				hits |= leafHits;
+				maxT = packet.GetMaxT(rayMask);
+			}
+			continue;
+		}
+
+		uint32_t nearChild = entry.Node + 1;
+		uint32_t farChild = node.Offset;
+		float nearDistance, farDistance;
+		bool hitNear = packet.IntersectInterval(Nodes[nearChild].Bounds, origin, tMin, maxT, nearDistance);
+		bool hitFar = packet.IntersectInterval(Nodes[farChild].Bounds, origin, tMin, maxT, farDistance);
+
+		if (hitNear && hitFar) {
+			if (farDistance < nearDistance) {
+				std::swap(nearChild, farChild);
+				std::swap(nearDistance, farDistance);
+			}
+			stack[stackSize++] = { farChild, farDistance };
+			stack[stackSize++] = { nearChild, nearDistance };
+		} else if (hitNear) {
+			stack[stackSize++] = { nearChild, nearDistance };
+		} else if (hitFar) {
+			stack[stackSize++] = { farChild, farDistance };
+		}
+	}
+
+	return hits;
+}
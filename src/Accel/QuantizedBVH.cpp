@@ -0,0 +1,133 @@
+#include "QuantizedBVH.h"
+
+#include "Accel/Simd.h"
+
+#include <string.h>
+
+namespace
+{
+	// the decode is a single rounding (q * 2^e is exact), so it matches the SIMD traversal bit for bit
+	inline float Dequantize(float origin, uint8_t q, float scale)
+	{
+		return origin + (float)q * scale;
+	}
+
+	void QuantizeAxis(const float* childMin, const float* childMax, uint32_t childCount, float& origin, int8_t& exponent,
+			uint8_t* qMin, uint8_t* qMax)
+	{
+		float parentMin = std::numeric_limits<float>::max();
+		float parentMax = std::numeric_limits<float>::lowest();
+		for (uint32_t i = 0; i < childCount; i++) {
+			parentMin = std::min(parentMin, childMin[i]);
+			parentMax = std::max(parentMax, childMax[i]);
+		}
+
+		// leave one step of headroom for rounding the upper bounds outwards
+		float extent = parentMax - parentMin;
+		int e = extent > 0.0f ? (int)std::ceil(std::log2(extent / 254.0f)) : 0;
+		e = std::clamp(e, -126, 127);
+		float scale = std::ldexp(1.0f, e);
+
+		origin = parentMin;
+		exponent = (int8_t)e;
+		for (uint32_t i = 0; i < 4; i++) {
+			if (i >= childCount) {
+				qMin[i] = qMax[i] = 0;
+				continue;
+			}
+
+			int lo = std::clamp((int)std::floor((childMin[i] - origin) / scale), 0, 255);
+			int hi = std::clamp((int)std::ceil((childMax[i] - origin) / scale), 0, 255);
+			while (lo > 0 && Dequantize(origin, (uint8_t)lo, scale) > childMin[i])
+				lo--;
+			while (hi < 255 && Dequantize(origin, (uint8_t)hi, scale) < childMax[i])
+				hi++;
+
+			qMin[i] = (uint8_t)lo;
+			qMax[i] = (uint8_t)hi;
+		}
+	}
+}
+
+void QuantizedBVH::Build(const WideBVH<4>& wide)
+{
+	Nodes.resize(wide.Nodes.size());
+	PrimitiveIndices = wide.PrimitiveIndices;
+
+	for (size_t n = 0; n < wide.Nodes.size(); n++) {
+		const WideBVHNode<4>& source = wide.Nodes[n];
+		QuantizedBVHNode& node = Nodes[n];
+
+		node.ChildCount = (uint8_t)source.ChildCount;
+		QuantizeAxis(source.MinX, source.MaxX, source.ChildCount, node.Origin[0], node.Exponent[0], node.QMinX, node.QMaxX);
+		QuantizeAxis(source.MinY, source.MaxY, source.ChildCount, node.Origin[1], node.Exponent[1], node.QMinY, node.QMaxY);
+		QuantizeAxis(source.MinZ, source.MaxZ, source.ChildCount, node.Origin[2], node.Exponent[2], node.QMinZ, node.QMaxZ);
+
+		for (int i = 0; i < 4; i++) {
+			ASSERT(source.PrimitiveCount[i] <= std::numeric_limits<uint16_t>::max(), "Leaf too large for QuantizedBVHNode")
+			node.Child[i] = source.Child[i];
+			node.PrimitiveCount[i] = (uint16_t)source.PrimitiveCount[i];
+		}
+	}
+}
+
+#if RT_SIMD_X86
+
+namespace
+{
+	inline __m128 DecodeAxis(const uint8_t* q, float origin, int8_t exponent)
+	{
+		// widen the 4 bytes to 32 bit lanes with SSE2 unpacks
+		const __m128i zero = _mm_setzero_si128();
+		int32_t packed;
+		memcpy(&packed, q, sizeof(packed)); // q is not 4 byte aligned
+		__m128i bytes = _mm_cvtsi32_si128(packed);
+		__m128i lanes = _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero);
+		// 2^exponent built straight from the float exponent bits
+		__m128 scale = _mm_castsi128_ps(_mm_set1_epi32((exponent + 127) << 23));
+		return _mm_add_ps(_mm_set1_ps(origin), _mm_mul_ps(_mm_cvtepi32_ps(lanes), scale));
+	}
+}
+
+int QuantizedBVH::IntersectChildren(const QuantizedBVHNode& node, const glm::vec3& origin, const glm::vec3& invDir,
+		float tMin, float tMax, float* distances)
+{
+	const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+	const __m128 ix = _mm_set1_ps(invDir.x), iy = _mm_set1_ps(invDir.y), iz = _mm_set1_ps(invDir.z);
+
+	__m128 t0x = _mm_mul_ps(_mm_sub_ps(DecodeAxis(node.QMinX, node.Origin[0], node.Exponent[0]), ox), ix);
+	__m128 t1x = _mm_mul_ps(_mm_sub_ps(DecodeAxis(node.QMaxX, node.Origin[0], node.Exponent[0]), ox), ix);
+	__m128 t0y = _mm_mul_ps(_mm_sub_ps(DecodeAxis(node.QMinY, node.Origin[1], node.Exponent[1]), oy), iy);
+	__m128 t1y = _mm_mul_ps(_mm_sub_ps(DecodeAxis(node.QMaxY, node.Origin[1], node.Exponent[1]), oy), iy);
+	__m128 t0z = _mm_mul_ps(_mm_sub_ps(DecodeAxis(node.QMinZ, node.Origin[2], node.Exponent[2]), oz), iz);
+	__m128 t1z = _mm_mul_ps(_mm_sub_ps(DecodeAxis(node.QMaxZ, node.Origin[2], node.Exponent[2]), oz), iz);
+
+	__m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_set1_ps(tMin)));
+	__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(tMax)));
+
+	_mm_storeu_ps(distances, enter);
+	return _mm_movemask_ps(_mm_cmple_ps(enter, exit)) & ((1 << node.ChildCount) - 1);
+}
+
+#else // RT_SIMD_X86
+
+int QuantizedBVH::IntersectChildren(const QuantizedBVHNode& node, const glm::vec3& origin, const glm::vec3& invDir,
+		float tMin, float tMax, float* distances)
+{
+	const glm::vec3 nodeOrigin(node.Origin[0], node.Origin[1], node.Origin[2]);
+	const glm::vec3 scale(std::ldexp(1.0f, node.Exponent[0]), std::ldexp(1.0f, node.Exponent[1]), std::ldexp(1.0f, node.Exponent[2]));
+
+	int mask = 0;
+	for (uint32_t i = 0; i < node.ChildCount; i++) {
+		Bounds3f bounds;
+		bounds.pMin = glm::vec3(Dequantize(nodeOrigin.x, node.QMinX[i], scale.x), Dequantize(nodeOrigin.y, node.QMinY[i], scale.y),
+				Dequantize(nodeOrigin.z, node.QMinZ[i], scale.z));
+		bounds.pMax = glm::vec3(Dequantize(nodeOrigin.x, node.QMaxX[i], scale.x), Dequantize(nodeOrigin.y, node.QMaxY[i], scale.y),
+				Dequantize(nodeOrigin.z, node.QMaxZ[i], scale.z));
+		if (bounds.IntersectP(origin, invDir, tMin, tMax, distances[i]))
+			mask |= 1 << i;
+	}
+	return mask;
+}
+
+#endif // RT_SIMD_X86
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "RayTracer.h"
+#include "Ray.h"
+#include "Accel/WideBVH.h"
+
+// 4 wide node in a single cache line. Child bounds are 8 bit offsets on a per axis power of two grid anchored
+// at the node's lower corner, rounded outwards so the decoded boxes always contain the real ones.
+struct alignas(64) QuantizedBVHNode
+{
+	float Origin[3];
+	int8_t Exponent[3]; // grid spacing is 2^Exponent
+	uint8_t ChildCount;
+	uint8_t QMinX[4], QMinY[4], QMinZ[4];
+	uint8_t QMaxX[4], QMaxY[4], QMaxZ[4];
+	uint32_t Child[4]; // node index for interior children, first primitive for leaves
+	uint16_t PrimitiveCount[4]; // 0 for interior children
+};
+
+static_assert(sizeof(QuantizedBVHNode) == 64, "QuantizedBVHNode must fill exactly one cache line");
+
+// Compressed version of a 4 wide BVH, about half its size, traded for decoding the child bounds on every visit
+class QuantizedBVH
+{
+public:
+	void Build(const WideBVH<4>& wide);
+
+	// Same contract as BVH::Intersect
+	template<typename HitFn>
+	bool Intersect(const Ray& r, float tMin, float& tMax, HitFn&& hitLeaf) const;
+
+	// Same contract as BVH::Occluded
+	template<typename OccludedFn>
+	bool Occluded(const Ray& r, float tMin, float tMax, OccludedFn&& occludedLeaf) const;
+
+	bool Empty() const { return Nodes.empty(); }
+
+	std::vector<QuantizedBVHNode> Nodes;
+	std::vector<uint32_t> PrimitiveIndices;
+
+private:
+	// Decodes and slab tests every child of the node, returns a bit mask of the hit ones and their entry distances
+	static int IntersectChildren(const QuantizedBVHNode& node, const glm::vec3& origin, const glm::vec3& invDir,
+			float tMin, float tMax, float* distances);
+};
+
+template<typename HitFn>
+bool QuantizedBVH::Intersect(const Ray& r, float tMin, float& tMax, HitFn&& hitLeaf) const
+{
+	if (Nodes.empty())
+		return false;
+
+	const glm::vec3 invDir = 1.0f / r.Direction;
+
+	struct StackEntry
+	{
+		uint32_t Index; // node, or first primitive of a leaf
+		uint32_t PrimitiveCount;
+		float Distance;
+	};
+	// every level replaces one entry with at most 4
+	StackEntry stack[BVH::MaxDepth * 3 + 1];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, 0, tMin };
+
+	bool hit = false;
+	while (stackSize > 0) {
+		const StackEntry entry = stack[--stackSize];
+		// a closer hit may have been found after this entry was pushed
+		if (entry.Distance > tMax)
+			continue;
+
+		if (entry.PrimitiveCount > 0) {
+			float hitDistance;
+			if (hitLeaf(entry.Index, entry.PrimitiveCount, tMin, tMax, hitDistance)) {
+				tMax = hitDistance;
+				hit = true;
+			}
+			continue;
+		}
+
+		const QuantizedBVHNode& node = Nodes[entry.Index];
+		float distances[4];
+		int mask = IntersectChildren(node, r.Origin, invDir, tMin, tMax, distances);
+		if (mask == 0)
+			continue;
+
+		// sort the hit children far to near, so the nearest ends up on top of the stack
+		StackEntry children[4];
+		int childCount = 0;
+		while (mask) {
+			int i = Utils::CountTrailingZeros((uint32_t)mask);
+			mask &= mask - 1;
+
+			StackEntry child = { node.Child[i], node.PrimitiveCount[i], distances[i] };
+			int j = childCount++;
+			while (j > 0 && children[j - 1].Distance < child.Distance) {
+				children[j] = children[j - 1];
+				j--;
+			}
+			children[j] = child;
+		}
+
+		for (int i = 0; i < childCount; i++)
+			stack[stackSize++] = children[i];
+	}
+
+	return hit;
+}
+
+template<typename OccludedFn>
+bool QuantizedBVH::Occluded(const Ray& r, float tMin, float tMax, OccludedFn&& occludedLeaf) const
+{
+	if (Nodes.empty())
+		return false;
+
+	const glm::vec3 invDir = 1.0f / r.Direction;
+
+	struct StackEntry
+	{
+		uint32_t Index; // node, or first primitive of a leaf
+		uint32_t PrimitiveCount;
+	};
+	StackEntry stack[BVH::MaxDepth * 3 + 1];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, 0 };
+
+	while (stackSize > 0) {
+		const StackEntry entry = stack[--stackSize];
+		if (entry.PrimitiveCount > 0) {
+			if (occludedLeaf(entry.Index, entry.PrimitiveCount, tMin, tMax))
+				return true;
+			continue;
+		}
+
+		// any hit child will do, so they are not sorted
+		const QuantizedBVHNode& node = Nodes[entry.Index];
+		float distances[4];
+		for (int mask = IntersectChildren(node, r.Origin, invDir, tMin, tMax, distances); mask; mask &= mask - 1) {
+			int i = Utils::CountTrailingZeros((uint32_t)mask);
+			stack[stackSize++] = { node.Child[i], node.PrimitiveCount[i] };
+		}
+	}
+
+	return false;
+}
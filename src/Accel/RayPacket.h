@@ -0,0 +1,72 @@
+#pragma once
+
+#include "RayTracer.h"
+#include "Ray.h"
+#include "Objects/BoundingBox.h"
+
+// Rays of a tile of pixels that share their origin, like the primary rays of the camera. When every direction has
+// the same sign on each axis the packet is coherent: a box can then be culled for all rays at once from the interval
+// of 1 / direction over the packet (interval arithmetic, Boulos et al. 2006).
+struct RayPacket
+{
+	static constexpr int MaxSize = 64; // 8x8 pixels
+	static constexpr int TileSize = 8;
+
+	int Size = 0;
+	glm::vec3 Origin;
+	glm::vec3 Directions[MaxSize];
+	glm::vec3 InvDirections[MaxSize];
+	float TMax[MaxSize]; // closest hit so far
+	int ObjectIndex[MaxSize];
+
+	bool Coherent = false;
+	glm::vec3 InvDirMin, InvDirMax;
+
+	// Call once Origin and Directions are filled in
+	void Setup() {
+		InvDirMin = glm::vec3(std::numeric_limits<float>::max());
+		InvDirMax = glm::vec3(std::numeric_limits<float>::lowest());
+		bool positive[3] = {}, negative[3] = {}, zero = false;
+		for (int i = 0; i < Size; i++) {
+			InvDirections[i] = 1.0f / Directions[i];
+			TMax[i] = std::numeric_limits<float>::max();
+			ObjectIndex[i] = -1;
+			for (int a = 0; a < 3; a++) {
+				positive[a] |= Directions[i][a] > 0.0f;
+				negative[a] |= Directions[i][a] < 0.0f;
+				zero |= Directions[i][a] == 0.0f;
+			}
+			InvDirMin = glm::min(InvDirMin, InvDirections[i]);
+			InvDirMax = glm::max(InvDirMax, InvDirections[i]);
+		}
+		Coherent = Size > 0 && !zero && positive[0] != negative[0] && positive[1] != negative[1] && positive[2] != negative[2];
+	}
+
+	Ray GetRay(int i) const { return Ray(Origin, Directions[i]); }
+
+	uint64_t GetMask() const { return Size == MaxSize ? ~0ull : (1ull << Size) - 1; }
+
+	// Largest TMax of the rays in mask, nothing further away can matter to them
+	float GetMaxT(uint64_t mask) const {
+		float maxT = 0.0f;
+		for (; mask; mask &= mask - 1)
+			maxT = std::max(maxT, TMax[Utils::CountTrailingZeros64(mask)]);
+		return maxT;
+	}
+
+	// Conservative test of a coherent packet from origin against bounds: false only if no ray can hit the box inside
+	// (tMin, maxT). tEnter is a lower bound of where any ray enters it.
+	bool IntersectInterval(const Bounds3f& bounds, const glm::vec3& origin, float tMin, float maxT, float& tEnter) const {
+		float enter = tMin, exit = maxT;
+		for (int a = 0; a < 3; a++) {
+			// near and far plane are the same for every ray on a coherent axis
+			bool positive = InvDirMin[a] > 0.0f;
+			float dNear = (positive ? bounds.pMin[a] : bounds.pMax[a]) - origin[a];
+			float dFar = (positive ? bounds.pMax[a] : bounds.pMin[a]) - origin[a];
+			enter = std::max(enter, std::min(dNear * InvDirMin[a], dNear * InvDirMax[a]));
+			exit = std::min(exit, std::max(dFar * InvDirMin[a], dFar * InvDirMax[a]));
+		}
+		tEnter = enter;
+		return enter <= exit;
+	}
+};
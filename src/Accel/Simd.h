@@ -0,0 +1,80 @@
+#pragma once
+
+#include "RayTracer.h"
+
+// SIMD kernels are only written for x86-64, everything else takes the scalar paths
+#if defined(__x86_64__) || defined(_M_X64)
+#define RT_SIMD_X86 1
+#include <immintrin.h>
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+#else
+#define RT_SIMD_X86 0
+#endif
+
+// Lets a single function use instructions the rest of the binary is not compiled for,
+// callers must check the matching Simd::Has* first. MSVC emits any intrinsic without flags.
+#if RT_SIMD_X86 && !defined(_MSC_VER)
+#define RT_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define RT_TARGET_AVX2 __attribute__((target("avx2,fma")))
+// AVX without FMA, for kernels that have to round exactly like their scalar versions
+#define RT_TARGET_AVX __attribute__((target("avx")))
+#else
+#define RT_TARGET_SSE41
+#define RT_TARGET_AVX2
+#define RT_TARGET_AVX
+#endif
+
+namespace Simd
+{
+	struct CPUFeatures
+	{
+		bool SSE41 = false;
+		bool AVX2 = false; // with FMA
+	};
+
+	inline CPUFeatures DetectCPUFeatures()
+	{
+		CPUFeatures features;
+#if RT_SIMD_X86
+#ifdef _WIN32
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+
+		__cpuid(info, 1);
+		features.SSE41 = (info[2] & (1 << 19)) != 0;
+		bool fma = (info[2] & (1 << 12)) != 0;
+		// AVX state also has to be enabled by the OS
+		bool osAVX = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0x6) == 0x6;
+
+		if (maxLeaf >= 7) {
+			__cpuidex(info, 7, 0);
+			features.AVX2 = osAVX && fma && (info[1] & (1 << 5)) != 0;
+		}
+#else
+		__builtin_cpu_init();
+		features.SSE41 = __builtin_cpu_supports("sse4.1");
+		features.AVX2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+#endif
+		return features;
+	}
+
+	inline const CPUFeatures& GetCPUFeatures()
+	{
+		static const CPUFeatures features = DetectCPUFeatures();
+		return features;
+	}
+
+	// widest BVH node the CPU can test in one go: 8 with AVX2, 4 with SSE, otherwise the binary BVH
+	inline int GetBVHWidth()
+	{
+#if RT_SIMD_X86
+		return GetCPUFeatures().AVX2 ? 8 : 4;
+#else
+		return 2;
+#endif
+	}
+}
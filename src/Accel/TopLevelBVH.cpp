@@ -0,0 +1,126 @@
+#include "TopLevelBVH.h"
+
+#include <chrono>
+
+bool TopLevelBVH::Update(const std::vector<Object*>& objects)
+{
+	std::vector<uint32_t> boundedObjects, unboundedObjects;
+	std::vector<Bounds3f> objectBounds;
+	boundedObjects.reserve(objects.size());
+	objectBounds.reserve(objects.size());
+
+	for (uint32_t i = 0; i < (uint32_t)objects.size(); i++) {
+		if (objects[i]->IsBounded()) {
+			boundedObjects.push_back(i);
+			objectBounds.push_back(objects[i]->GetBounds());
+		} else {
+			unboundedObjects.push_back(i);
+		}
+	}
+
+	auto sameBounds = [](const Bounds3f& a, const Bounds3f& b) { return a.pMin == b.pMin && a.pMax == b.pMax; };
+	m_Objects = &objects;
+	if (boundedObjects == m_BoundedObjects && unboundedObjects == m_UnboundedObjects
+			&& std::equal(objectBounds.begin(), objectBounds.end(), m_ObjectBounds.begin(), sameBounds))
+		return false;
+
+	std::chrono::time_point <std::chrono::high_resolution_clock> start, end;
+	start = std::chrono::high_resolution_clock::now();
+
+	m_BoundedObjects = std::move(boundedObjects);
+	m_UnboundedObjects = std::move(unboundedObjects);
+	m_ObjectBounds = std::move(objectBounds);
+	m_BVH.Build(m_ObjectBounds);
+
+	end = std::chrono::high_resolution_clock::now();
+	long duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	printf("Built top level BVH with %zu nodes over %zu objects in %ldus\n", m_BVH.Nodes.size(), m_BoundedObjects.size(), duration);
+	return true;
+}
+
+bool TopLevelBVH::Intersect(const Ray& r, float tMin, float& tMax, int& objectIndex) const
+{
+	if (m_Objects == nullptr)
+		return false;
+
+	const std::vector<Object*>& objects = *m_Objects;
+	bool hit = false;
+
+	for (uint32_t index : m_UnboundedObjects) {
+		float hitDistance;
+		if (objects[index]->Hit(r, tMin, tMax, hitDistance) && hitDistance > tMin && hitDistance < tMax) {
+			tMax = hitDistance;
+			objectIndex = (int)index;
+			hit = true;
+		}
+	}
+
+	hit |= m_BVH.Intersect(r, tMin, tMax, [&](uint32_t first, uint32_t count, float tMin, float tMax, float& hitDistance) {
+			bool leafHit = false;
+			for (uint32_t i = first; i < first + count; i++) {
+				uint32_t index = m_BoundedObjects[m_BVH.PrimitiveIndices[i]];
+				float distance;
+				if (objects[index]->Hit(r, tMin, tMax, distance) && distance > tMin && distance < tMax) {
+					tMax = distance;
+					hitDistance = distance;
+					objectIndex = (int)index;
+					leafHit = true;
+				}
+			}
+			return leafHit;
+			});
+
+	return hit;
+}
+
+bool TopLevelBVH::Occluded(const Ray& r, float tMin, float tMax) const
+{
+	if (m_Objects == nullptr)
+		return false;
+
+	const std::vector<Object*>& objects = *m_Objects;
+	for (uint32_t index : m_UnboundedObjects) {
+		if (objects[index]->Occluded(r, tMin, tMax))
+			return true;
+	}
+
+	return m_BVH.Occluded(r, tMin, tMax, [&](uint32_t first, uint32_t count, float tMin, float tMax) {
+			for (uint32_t i = first; i < first + count; i++) {
+				if (objects[m_BoundedObjects[m_BVH.PrimitiveIndices[i]]]->Occluded(r, tMin, tMax))
+					return true;
+			}
+			return false;
+			});
+}
+
+void TopLevelBVH::IntersectPacket(RayPacket& packet, float tMin) const
+{
+	if (m_Objects == nullptr)
+		return;
+
+	if (!packet.Coherent) {
+		for (int i = 0; i < packet.Size; i++)
+			Intersect(packet.GetRay(i), tMin, packet.TMax[i], packet.ObjectIndex[i]);
+		return;
+	}
+
+	const std::vector<Object*>& objects = *m_Objects;
+	auto setObject = [&](uint64_t hits, uint32_t index) {
+		for (; hits; hits &= hits - 1)
+			packet.ObjectIndex[Utils::CountTrailingZeros64(hits)] = (int)index;
+	};
+
+	for (uint32_t index : m_UnboundedObjects)
+		setObject(objects[index]->IntersectPacket(packet, tMin, packet.GetMask()), index);
+
+	m_BVH.IntersectPacket(packet.Origin, packet, tMin, packet.GetMask(), [&](uint32_t first, uint32_t count, uint64_t rays) {
+			uint64_t hits = 0;
+			for (uint32_t i = first; i < first + count; i++) {
+				uint32_t index = m_BoundedObjects[m_BVH.PrimitiveIndices[i]];
+				uint64_t objectHits = objects[index]->IntersectPacket(packet, tMin, rays);
+				setObject(objectHits, index);
+				hits |= objectHits;
+			}
+			return hits;
+			});
+}
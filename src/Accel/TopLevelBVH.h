@@ -0,0 +1,38 @@
+#pragma once
+
+#include "RayTracer.h"
+#include "Ray.h"
+#include "Accel/BVH.h"
+#include "Objects/Object.h"
+
+// Scene level hierarchy over object bounds. Its leaves hand rays to Object::Hit, which for meshes
+// continues into the mesh's own (bottom level) BVH.
+class TopLevelBVH
+{
+public:
+	// Rebuilds the hierarchy if objects were added, removed or changed their bounds since the last call, returns
+	// whether it did
+	bool Update(const std::vector<Object*>& objects);
+
+	// Closest hit over all objects, returns the index into the object list passed to Update
+	bool Intersect(const Ray& r, float tMin, float& tMax, int& objectIndex) const;
+
+	// Whether any object lies in (tMin, tMax) along r, stops at the first one found
+	bool Occluded(const Ray& r, float tMin, float tMax) const;
+
+	// Closest hits of a whole packet, sets packet.TMax and packet.ObjectIndex of every ray that hits something.
+	// Incoherent packets fall back to tracing one ray at a time.
+	void IntersectPacket(RayPacket& packet, float tMin) const;
+
+	size_t GetNodeCount() const { return m_BVH.Nodes.size(); }
+	// Bounds of the bounded objects, planes are left out
+	Bounds3f GetBounds() const { return m_BVH.Nodes.empty() ? Bounds3f() : m_BVH.Nodes[0].Bounds; }
+
+private:
+	BVH m_BVH;
+
+	const std::vector<Object*>* m_Objects = nullptr;
+	std::vector<uint32_t> m_BoundedObjects; // object index of every BVH primitive
+	std::vector<uint32_t> m_UnboundedObjects; // tested against every ray
+	std::vector<Bounds3f> m_ObjectBounds;
+};
@@ -0,0 +1,300 @@
+#include "TriangleData.h"
+
+#include "Accel/Simd.h"
+
+namespace
+{
+	// Every kernel tests the first laneCount triangles of one packet and returns the lane of the nearest hit inside
+	// (tMin, tMax), or -1. Ties go to the lowest lane, like the scalar loop.
+	int IntersectPacketScalar(const float* packet, uint32_t width, const TriangleRay& r, uint32_t laneCount, float tMin, float tMax, float& hitDistance)
+	{
+		int nearest = -1;
+		for (uint32_t i = 0; i < laneCount; i++) {
+			const glm::vec3 a(packet[0 * width + i], packet[1 * width + i], packet[2 * width + i]);
+			const glm::vec3 b(packet[3 * width + i], packet[4 * width + i], packet[5 * width + i]);
+			const glm::vec3 c(packet[6 * width + i], packet[7 * width + i], packet[8 * width + i]);
+
+			float distance;
+#ifdef RT_WATERTIGHT_TRIANGLES
+			bool hit = IntersectTriangleWatertight(r, a, b, c, distance);
+#else
+			bool hit = IntersectTriangleMT(r, a, b, c, distance);
+#endif
+			if (hit && distance > tMin && distance < tMax) {
+				tMax = distance;
+				hitDistance = distance;
+				nearest = (int)i;
+			}
+		}
+		return nearest;
+	}
+
+#if RT_SIMD_X86
+
+	// The SIMD kernels do the exact same operations in the same order as the scalar tests and are built without FMA,
+	// so they agree bit for bit.
+
+	RT_TARGET_SSE41 int NearestLaneSSE41(__m128 t, __m128 mask, uint32_t laneCount, float& hitDistance)
+	{
+		int lanes = _mm_movemask_ps(mask) & ((1 << laneCount) - 1);
+		if (lanes == 0)
+			return -1;
+
+		t = _mm_blendv_ps(_mm_set1_ps(std::numeric_limits<float>::infinity()), t, mask);
+		__m128 nearest = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+		nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+		int lane = Utils::CountTrailingZeros(lanes & _mm_movemask_ps(_mm_cmpeq_ps(t, nearest)));
+		hitDistance = _mm_cvtss_f32(nearest);
+		return lane;
+	}
+
+	RT_TARGET_AVX int NearestLaneAVX(__m256 t, __m256 mask, uint32_t laneCount, float& hitDistance)
+	{
+		int lanes = _mm256_movemask_ps(mask) & ((1 << laneCount) - 1);
+		if (lanes == 0)
+			return -1;
+
+		t = _mm256_blendv_ps(_mm256_set1_ps(std::numeric_limits<float>::infinity()), t, mask);
+		__m256 nearest = _mm256_min_ps(t, _mm256_permute2f128_ps(t, t, 1));
+		nearest = _mm256_min_ps(nearest, _mm256_shuffle_ps(nearest, nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+		nearest = _mm256_min_ps(nearest, _mm256_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+		int lane = Utils::CountTrailingZeros(lanes & _mm256_movemask_ps(_mm256_cmp_ps(t, nearest, _CMP_EQ_OQ)));
+		hitDistance = _mm256_cvtss_f32(nearest);
+		return lane;
+	}
+
+#ifndef RT_WATERTIGHT_TRIANGLES
+
+	RT_TARGET_SSE41 int IntersectPacketSSE41(const float* packet, const TriangleRay& r, uint32_t laneCount, float tMin, float tMax, float& hitDistance)
+	{
+		const __m128 dx = _mm_set1_ps(r.Direction.x), dy = _mm_set1_ps(r.Direction.y), dz = _mm_set1_ps(r.Direction.z);
+		const __m128 v0x = _mm_loadu_ps(packet + 0), v0y = _mm_loadu_ps(packet + 4), v0z = _mm_loadu_ps(packet + 8);
+		const __m128 e1x = _mm_loadu_ps(packet + 12), e1y = _mm_loadu_ps(packet + 16), e1z = _mm_loadu_ps(packet + 20);
+		const __m128 e2x = _mm_loadu_ps(packet + 24), e2y = _mm_loadu_ps(packet + 28), e2z = _mm_loadu_ps(packet + 32);
+
+		// h = cross(direction, edge2)
+		const __m128 hx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+		const __m128 hy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+		const __m128 hz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+		const __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz));
+		const __m128 f = _mm_div_ps(_mm_set1_ps(1.0f), a);
+
+		const __m128 sx = _mm_sub_ps(_mm_set1_ps(r.Origin.x), v0x);
+		const __m128 sy = _mm_sub_ps(_mm_set1_ps(r.Origin.y), v0y);
+		const __m128 sz = _mm_sub_ps(_mm_set1_ps(r.Origin.z), v0z);
+		const __m128 u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz)));
+
+		// q = cross(s, edge1)
+		const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(e1y, sz));
+		const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(e1z, sx));
+		const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(e1x, sy));
+		const __m128 v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+		const __m128 t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+		__m128 mask = _mm_and_ps(_mm_cmpneq_ps(a, zero), _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(tMin)), _mm_cmplt_ps(t, _mm_set1_ps(tMax))));
+		return NearestLaneSSE41(t, mask, laneCount, hitDistance);
+	}
+
+	RT_TARGET_AVX int IntersectPacketAVX(const float* packet, const TriangleRay& r, uint32_t laneCount, float tMin, float tMax, float& hitDistance)
+	{
+		const __m256 dx = _mm256_set1_ps(r.Direction.x), dy = _mm256_set1_ps(r.Direction.y), dz = _mm256_set1_ps(r.Direction.z);
+		const __m256 v0x = _mm256_loadu_ps(packet + 0), v0y = _mm256_loadu_ps(packet + 8), v0z = _mm256_loadu_ps(packet + 16);
+		const __m256 e1x = _mm256_loadu_ps(packet + 24), e1y = _mm256_loadu_ps(packet + 32), e1z = _mm256_loadu_ps(packet + 40);
+		const __m256 e2x = _mm256_loadu_ps(packet + 48), e2y = _mm256_loadu_ps(packet + 56), e2z = _mm256_loadu_ps(packet + 64);
+
+		// h = cross(direction, edge2)
+		const __m256 hx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz));
+		const __m256 hy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx));
+		const __m256 hz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy));
+		const __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx), _mm256_mul_ps(e1y, hy)), _mm256_mul_ps(e1z, hz));
+		const __m256 f = _mm256_div_ps(_mm256_set1_ps(1.0f), a);
+
+		const __m256 sx = _mm256_sub_ps(_mm256_set1_ps(r.Origin.x), v0x);
+		const __m256 sy = _mm256_sub_ps(_mm256_set1_ps(r.Origin.y), v0y);
+		const __m256 sz = _mm256_sub_ps(_mm256_set1_ps(r.Origin.z), v0z);
+		const __m256 u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)), _mm256_mul_ps(sz, hz)));
+
+		// q = cross(s, edge1)
+		const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(e1y, sz));
+		const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(e1z, sx));
+		const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(e1x, sy));
+		const __m256 v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)));
+		const __m256 t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)));
+
+		const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+		__m256 mask = _mm256_and_ps(_mm256_cmp_ps(a, zero, _CMP_NEQ_UQ), _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+		mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+		mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(tMin), _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LT_OQ)));
+		return NearestLaneAVX(t, mask, laneCount, hitDistance);
+	}
+
+#else // RT_WATERTIGHT_TRIANGLES
+
+	// Row axis of vertex relative to the ray origin. Not a lambda like in the SSE kernel, those cannot carry a target attribute.
+	RT_TARGET_AVX __m256 RelativeRowAVX(const float* packet, int vertex, int axis, const TriangleRay& r)
+	{
+		return _mm256_sub_ps(_mm256_loadu_ps(packet + (3 * vertex + axis) * 8), _mm256_set1_ps(r.Origin[axis]));
+	}
+
+	RT_TARGET_SSE41 int IntersectPacketSSE41(const float* packet, const TriangleRay& r, uint32_t laneCount, float tMin, float tMax, float& hitDistance)
+	{
+		// rows of the vertices relative to the ray origin, sheared below
+		auto row = [&](int vertex, int axis) { return _mm_sub_ps(_mm_loadu_ps(packet + (3 * vertex + axis) * 4), _mm_set1_ps(r.Origin[axis])); };
+		const __m128 sx = _mm_set1_ps(r.Sx), sy = _mm_set1_ps(r.Sy), sz = _mm_set1_ps(r.Sz);
+
+		const __m128 Az = row(0, r.Kz), Bz = row(1, r.Kz), Cz = row(2, r.Kz);
+		const __m128 Ax = _mm_sub_ps(row(0, r.Kx), _mm_mul_ps(sx, Az)), Ay = _mm_sub_ps(row(0, r.Ky), _mm_mul_ps(sy, Az));
+		const __m128 Bx = _mm_sub_ps(row(1, r.Kx), _mm_mul_ps(sx, Bz)), By = _mm_sub_ps(row(1, r.Ky), _mm_mul_ps(sy, Bz));
+		const __m128 Cx = _mm_sub_ps(row(2, r.Kx), _mm_mul_ps(sx, Cz)), Cy = _mm_sub_ps(row(2, r.Ky), _mm_mul_ps(sy, Cz));
+
+		const __m128 U = _mm_sub_ps(_mm_mul_ps(Cx, By), _mm_mul_ps(Cy, Bx));
+		const __m128 V = _mm_sub_ps(_mm_mul_ps(Ax, Cy), _mm_mul_ps(Ay, Cx));
+		const __m128 W = _mm_sub_ps(_mm_mul_ps(Bx, Ay), _mm_mul_ps(By, Ax));
+
+		// a lane exactly on an edge needs the double precision fallback of the scalar test
+		const __m128 zero = _mm_setzero_ps();
+		__m128 onEdge = _mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(U, zero), _mm_cmpeq_ps(V, zero)), _mm_cmpeq_ps(W, zero));
+		if (_mm_movemask_ps(onEdge) & ((1 << laneCount) - 1))
+			return IntersectPacketScalar(packet, 4, r, laneCount, tMin, tMax, hitDistance);
+
+		__m128 negative = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(U, zero), _mm_cmplt_ps(V, zero)), _mm_cmplt_ps(W, zero));
+		__m128 positive = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(U, zero), _mm_cmpgt_ps(V, zero)), _mm_cmpgt_ps(W, zero));
+		const __m128 det = _mm_add_ps(_mm_add_ps(U, V), W);
+		const __m128 T = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(U, sz), Az), _mm_mul_ps(_mm_mul_ps(V, sz), Bz)), _mm_mul_ps(_mm_mul_ps(W, sz), Cz));
+		const __m128 t = _mm_div_ps(T, det);
+
+		__m128 mask = _mm_andnot_ps(_mm_and_ps(negative, positive), _mm_cmpneq_ps(det, zero));
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(tMin)), _mm_cmplt_ps(t, _mm_set1_ps(tMax))));
+		return NearestLaneSSE41(t, mask, laneCount, hitDistance);
+	}
+
+	RT_TARGET_AVX int IntersectPacketAVX(const float* packet, const TriangleRay& r, uint32_t laneCount, float tMin, float tMax, float& hitDistance)
+	{
+		const __m256 sx = _mm256_set1_ps(r.Sx), sy = _mm256_set1_ps(r.Sy), sz = _mm256_set1_ps(r.Sz);
+
+		const __m256 Az = RelativeRowAVX(packet, 0, r.Kz, r), Bz = RelativeRowAVX(packet, 1, r.Kz, r), Cz = RelativeRowAVX(packet, 2, r.Kz, r);
+		const __m256 Ax = _mm256_sub_ps(RelativeRowAVX(packet, 0, r.Kx, r), _mm256_mul_ps(sx, Az)), Ay = _mm256_sub_ps(RelativeRowAVX(packet, 0, r.Ky, r), _mm256_mul_ps(sy, Az));
+		const __m256 Bx = _mm256_sub_ps(RelativeRowAVX(packet, 1, r.Kx, r), _mm256_mul_ps(sx, Bz)), By = _mm256_sub_ps(RelativeRowAVX(packet, 1, r.Ky, r), _mm256_mul_ps(sy, Bz));
+		const __m256 Cx = _mm256_sub_ps(RelativeRowAVX(packet, 2, r.Kx, r), _mm256_mul_ps(sx, Cz)), Cy = _mm256_sub_ps(RelativeRowAVX(packet, 2, r.Ky, r), _mm256_mul_ps(sy, Cz));
+
+		const __m256 U = _mm256_sub_ps(_mm256_mul_ps(Cx, By), _mm256_mul_ps(Cy, Bx));
+		const __m256 V = _mm256_sub_ps(_mm256_mul_ps(Ax, Cy), _mm256_mul_ps(Ay, Cx));
+		const __m256 W = _mm256_sub_ps(_mm256_mul_ps(Bx, Ay), _mm256_mul_ps(By, Ax));
+
+		// a lane exactly on an edge needs the double precision fallback of the scalar test
+		const __m256 zero = _mm256_setzero_ps();
+		__m256 onEdge = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(U, zero, _CMP_EQ_OQ), _mm256_cmp_ps(V, zero, _CMP_EQ_OQ)), _mm256_cmp_ps(W, zero, _CMP_EQ_OQ));
+		if (_mm256_movemask_ps(onEdge) & ((1 << laneCount) - 1))
+			return IntersectPacketScalar(packet, 8, r, laneCount, tMin, tMax, hitDistance);
+
+		__m256 negative = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(U, zero, _CMP_LT_OQ), _mm256_cmp_ps(V, zero, _CMP_LT_OQ)), _mm256_cmp_ps(W, zero, _CMP_LT_OQ));
+		__m256 positive = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(U, zero, _CMP_GT_OQ), _mm256_cmp_ps(V, zero, _CMP_GT_OQ)), _mm256_cmp_ps(W, zero, _CMP_GT_OQ));
+		const __m256 det = _mm256_add_ps(_mm256_add_ps(U, V), W);
+		const __m256 T = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(U, sz), Az), _mm256_mul_ps(_mm256_mul_ps(V, sz), Bz)), _mm256_mul_ps(_mm256_mul_ps(W, sz), Cz));
+		const __m256 t = _mm256_div_ps(T, det);
+
+		__m256 mask = _mm256_andnot_ps(_mm256_and_ps(negative, positive), _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ));
+		mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(tMin), _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LT_OQ)));
+		return NearestLaneAVX(t, mask, laneCount, hitDistance);
+	}
+
+#endif // RT_WATERTIGHT_TRIANGLES
+
+#endif // RT_SIMD_X86
+}
+
+TriangleKernel TriangleData::GetDefaultKernel()
+{
+	const Simd::CPUFeatures& features = Simd::GetCPUFeatures();
+	if (features.AVX2)
+		return TriangleKernel::AVX2;
+	if (features.SSE41)
+		return TriangleKernel::SSE41;
+	return TriangleKernel::Scalar;
+}
+
+void TriangleData::Update(uint32_t triangle, const glm::vec3 v[3])
+{
+	Set(m_Lanes[triangle], v);
+}
+
+bool TriangleData::IntersectLeaf(const TriangleRay& r, uint32_t first, uint32_t count, float tMin, float tMax, float& hitDistance,
+		uint32_t* hitLane) const
+{
+	const float* packet = &m_Packets[(size_t)m_LeafPackets[first] * Rows * m_Width];
+	bool hit = false;
+	for (uint32_t done = 0; done < count; done += m_Width, packet += Rows * m_Width) {
+		uint32_t laneCount = std::min(count - done, m_Width);
+		float distance;
+		int lane;
+		switch (m_Kernel) {
+#if RT_SIMD_X86
+			case TriangleKernel::AVX2: lane = IntersectPacketAVX(packet, r, laneCount, tMin, tMax, distance); break;
+			case TriangleKernel::SSE41: lane = IntersectPacketSSE41(packet, r, laneCount, tMin, tMax, distance); break;
+#endif
+			default: lane = IntersectPacketScalar(packet, m_Width, r, laneCount, tMin, tMax, distance); break;
+		}
+
+		if (lane >= 0) {
+			tMax = distance;
+			hitDistance = distance;
+			hit = true;
+			if (hitLane)
+				*hitLane = (m_LeafPackets[first] + done / m_Width) * m_Width + lane;
+		}
+	}
+	return hit;
+}
+
+bool TriangleData::OccludedLeaf(const TriangleRay& r, uint32_t first, uint32_t count, float tMin, float tMax) const
+{
+	const float* packet = &m_Packets[(size_t)m_LeafPackets[first] * Rows * m_Width];
+	for (uint32_t done = 0; done < count; done += m_Width, packet += Rows * m_Width) {
+		uint32_t laneCount = std::min(count - done, m_Width);
+		float distance;
+		int lane;
+		switch (m_Kernel) {
+#if RT_SIMD_X86
+			case TriangleKernel::AVX2: lane = IntersectPacketAVX(packet, r, laneCount, tMin, tMax, distance); break;
+			case TriangleKernel::SSE41: lane = IntersectPacketSSE41(packet, r, laneCount, tMin, tMax, distance); break;
+#endif
+			default: lane = IntersectPacketScalar(packet, m_Width, r, laneCount, tMin, tMax, distance); break;
+		}
+		if (lane >= 0)
+			return true;
+	}
+	return false;
+}
+
+glm::vec3 TriangleData::GetNormal(uint32_t lane) const
+{
+	const float* packet = &m_Packets[(size_t)(lane / m_Width) * Rows * m_Width];
+	uint32_t i = lane % m_Width;
+	glm::vec3 stored[3];
+	for (int k = 0; k < 3; k++)
+		stored[k] = glm::vec3(packet[(3 * k + 0) * m_Width + i], packet[(3 * k + 1) * m_Width + i], packet[(3 * k + 2) * m_Width + i]);
+#ifdef RT_WATERTIGHT_TRIANGLES
+	return glm::normalize(glm::cross(stored[1] - stored[0], stored[2] - stored[0]));
+#else
+	return glm::normalize(glm::cross(stored[1], stored[2]));
+#endif
+}
+
+void TriangleData::Set(uint32_t lane, const glm::vec3 v[3])
+{
+#ifdef RT_WATERTIGHT_TRIANGLES
+	const glm::vec3 stored[3] = { v[0], v[1], v[2] };
+#else
+	const glm::vec3 stored[3] = { v[0], v[1] - v[0], v[2] - v[0] };
+#endif
+	float* packet = &m_Packets[(size_t)(lane / m_Width) * Rows * m_Width];
+	uint32_t i = lane % m_Width;
+	for (int k = 0; k < 3; k++) {
+		packet[(3 * k + 0) * m_Width + i] = stored[k].x;
+		packet[(3 * k + 1) * m_Width + i] = stored[k].y;
+		packet[(3 * k + 2) * m_Width + i] = stored[k].z;
+	}
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "RayTracer.h"
+
+#include "Ray.h"
+#include "Accel/BVH.h"
+
+// Ray/triangle tests. Möller–Trumbore is the default, like TriangleHit in fragment.glsl. Define
+// RT_WATERTIGHT_TRIANGLES to use the watertight test (Woo et al. 2013) instead, which is a bit slower but
+// never lets a ray slip through the shared edge of two adjacent triangles. Both also report hits behind the origin,
+// with a negative distance, the callers test it against their own interval.
+
+// Everything about the ray the triangle tests need, set up once per ray
+struct TriangleRay
+{
+	glm::vec3 Origin;
+	glm::vec3 Direction;
+#ifdef RT_WATERTIGHT_TRIANGLES
+	// shear that maps the ray onto the +z axis
+	int Kx, Ky, Kz;
+	float Sx, Sy, Sz;
+#endif
+
+	TriangleRay() = default;
+	explicit TriangleRay(const Ray& r) : Origin(r.Origin), Direction(r.Direction) {
+#ifdef RT_WATERTIGHT_TRIANGLES
+		glm::vec3 absDirection = glm::abs(r.Direction);
+		Kz = absDirection.x > absDirection.y ? (absDirection.x > absDirection.z ? 0 : 2) : (absDirection.y > absDirection.z ? 1 : 2);
+		Kx = (Kz + 1) % 3;
+		Ky = (Kx + 1) % 3;
+		// keep the winding of the triangles
+		if (r.Direction[Kz] < 0.0f)
+			std::swap(Kx, Ky);
+		Sz = 1.0f / r.Direction[Kz];
+		Sx = r.Direction[Kx] * Sz;
+		Sy = r.Direction[Ky] * Sz;
+#endif
+	}
+};
+
+// Möller–Trumbore against v0 and the edges from it to v1 and v2
+inline bool IntersectTriangleMT(const TriangleRay& r, const glm::vec3& v0, const glm::vec3& edge1, const glm::vec3& edge2, float& hitDistance) {
+	glm::vec3 h = glm::cross(r.Direction, edge2);
+	float a = glm::dot(edge1, h);
+	// parallel, checked against zero rather than a fixed epsilon so small triangles are not lost
+	if (a == 0.0f)
+		return false;
+
+	float f = 1.0f / a;
+	glm::vec3 s = r.Origin - v0;
+	float u = f * glm::dot(s, h);
+	if (u < 0.0f || u > 1.0f)
+		return false;
+
+	glm::vec3 q = glm::cross(s, edge1);
+	float v = f * glm::dot(r.Direction, q);
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+
+	hitDistance = f * glm::dot(edge2, q);
+	return true;
+}
+
+#ifdef RT_WATERTIGHT_TRIANGLES
+inline bool IntersectTriangleWatertight(const TriangleRay& r, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float& hitDistance) {
+	const glm::vec3 A = v0 - r.Origin;
+	const glm::vec3 B = v1 - r.Origin;
+	const glm::vec3 C = v2 - r.Origin;
+
+	const float Ax = A[r.Kx] - r.Sx * A[r.Kz];
+	const float Ay = A[r.Ky] - r.Sy * A[r.Kz];
+	const float Bx = B[r.Kx] - r.Sx * B[r.Kz];
+	const float By = B[r.Ky] - r.Sy * B[r.Kz];
+	const float Cx = C[r.Kx] - r.Sx * C[r.Kz];
+	const float Cy = C[r.Ky] - r.Sy * C[r.Kz];
+
+	float U = Cx * By - Cy * Bx;
+	float V = Ax * Cy - Ay * Cx;
+	float W = Bx * Ay - By * Ax;
+
+	// the ray passes exactly through an edge, redo the edge functions in double so neighbours agree on who owns it
+	if (U == 0.0f || V == 0.0f || W == 0.0f) {
+		U = (float)((double)Cx * By - (double)Cy * Bx);
+		V = (float)((double)Ax * Cy - (double)Ay * Cx);
+		W = (float)((double)Bx * Ay - (double)By * Ax);
+	}
+
+	if ((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f))
+		return false;
+
+	const float det = U + V + W;
+	if (det == 0.0f)
+		return false;
+
+	const float T = U * r.Sz * A[r.Kz] + V * r.Sz * B[r.Kz] + W * r.Sz * C[r.Kz];
+	hitDistance = T / det;
+	return true;
+}
+#endif
+
+inline bool IntersectTriangle(const TriangleRay& r, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float& hitDistance) {
+#ifdef RT_WATERTIGHT_TRIANGLES
+	return IntersectTriangleWatertight(r, v0, v1, v2, hitDistance);
+#else
+	return IntersectTriangleMT(r, v0, v1 - v0, v2 - v0, hitDistance);
+#endif
+}
+
+enum class TriangleKernel
+{
+	Scalar,
+	SSE41, // 4 triangles per instruction
+	AVX2 // 8 triangles per instruction
+};
+
+// The triangles of every BVH leaf packed into packets of 4 or 8, structure of arrays inside each packet, so one
+// SIMD kernel tests a whole leaf against a ray. Packets hold v0 and both edges for Möller–Trumbore, or the three
+// vertices for the watertight test. The kernels give the same results as the scalar tests above.
+class TriangleData
+{
+public:
+	// The fastest kernel this CPU runs
+	static TriangleKernel GetDefaultKernel();
+	static uint32_t GetPacketWidth(TriangleKernel kernel) { return kernel == TriangleKernel::AVX2 ? 8 : 4; }
+
+	// bvh should be built with the packet width of kernel, vertices(triangle, v) fills in the vertices of a triangle
+	template<typename VertexFn>
+	void Build(const BVH& bvh, VertexFn&& vertices, TriangleKernel kernel = GetDefaultKernel());
+
+	// Updates a triangle after its vertices changed, the BVH order stays the same
+	void Update(uint32_t triangle, const glm::vec3 v[3]);
+
+	// Closest hit over the leaf holding BVH slots [first, first + count), same contract as the leaf callback of
+	// BVH::Intersect. hitLane, if given, is set to the packet lane of the triangle hit.
+	bool IntersectLeaf(const TriangleRay& r, uint32_t first, uint32_t count, float tMin, float tMax, float& hitDistance,
+			uint32_t* hitLane = nullptr) const;
+	// Whether any triangle of the leaf is hit in (tMin, tMax), stops at the first packet that has one
+	bool OccludedLeaf(const TriangleRay& r, uint32_t first, uint32_t count, float tMin, float tMax) const;
+
+	// Unit normal of the triangle in a packet lane, with the winding of its vertices
+	glm::vec3 GetNormal(uint32_t lane) const;
+
+	TriangleKernel GetKernel() const { return m_Kernel; }
+	size_t GetBytes() const { return m_Packets.size() * sizeof(float) + (m_LeafPackets.size() + m_Lanes.size()) * sizeof(uint32_t); }
+
+private:
+	static constexpr int Rows = 9; // three vectors, one row per component
+
+	void Set(uint32_t lane, const glm::vec3 v[3]);
+
+	TriangleKernel m_Kernel = TriangleKernel::Scalar;
+	uint32_t m_Width = 4;
+	std::vector<float> m_Packets; // Rows * m_Width floats per packet
+	std::vector<uint32_t> m_LeafPackets; // first packet of the leaf starting at a BVH slot
+	std::vector<uint32_t> m_Lanes; // triangle -> packet * m_Width + lane
+};
+
+template<typename VertexFn>
+void TriangleData::Build(const BVH& bvh, VertexFn&& vertices, TriangleKernel kernel)
+{
+	m_Kernel = kernel;
+	m_Width = GetPacketWidth(kernel);
+	m_LeafPackets.assign(bvh.PrimitiveIndices.size(), 0);
+	m_Lanes.resize(bvh.PrimitiveIndices.size());
+
+	uint32_t packetCount = 0;
+	for (const BVHNode& node : bvh.Nodes) {
+		if (node.PrimitiveCount > 0)
+			packetCount += (node.PrimitiveCount + m_Width - 1) / m_Width;
+	}
+	// unused lanes stay zero, the kernels mask them out
+	m_Packets.assign((size_t)packetCount * Rows * m_Width, 0.0f);
+
+	// packets follow the depth first node order, like the leaves are visited
+	uint32_t packet = 0;
+	for (const BVHNode& node : bvh.Nodes) {
+		if (node.PrimitiveCount == 0)
+			continue;
+
+		m_LeafPackets[node.Offset] = packet;
+		for (uint32_t i = 0; i < node.PrimitiveCount; i++) {
+			uint32_t triangle = bvh.PrimitiveIndices[node.Offset + i];
+			glm::vec3 v[3];
+			vertices(triangle, v);
+			m_Lanes[triangle] = packet * m_Width + i;
+			Set(m_Lanes[triangle], v);
+		}
+		packet += (node.PrimitiveCount + m_Width - 1) / m_Width;
+	}
+}
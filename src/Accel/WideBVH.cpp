@@ -0,0 +1,145 @@
+#include "WideBVH.h"
+
+#include "Accel/Simd.h"
+
+template<int Width>
+void WideBVH<Width>::Build(const BVH& bvh)
+{
+	Nodes.clear();
+	PrimitiveIndices = bvh.PrimitiveIndices;
+	if (bvh.Empty())
+		return;
+
+	// at most one wide node per interior binary node
+	Nodes.reserve(bvh.Nodes.size() / 2 + 1);
+	Nodes.emplace_back();
+	Collapse(bvh, 0, 0);
+	Nodes.shrink_to_fit();
+}
+
+template<int Width>
+void WideBVH<Width>::Collapse(const BVH& bvh, uint32_t binaryNode, uint32_t wideNode)
+{
+	auto isLeaf = [&](uint32_t index) { return bvh.Nodes[index].PrimitiveCount > 0; };
+
+	uint32_t children[Width];
+	int childCount = 0;
+	if (isLeaf(binaryNode)) {
+		// only happens for a root that is a leaf
+		children[childCount++] = binaryNode;
+	} else {
+		children[childCount++] = binaryNode + 1;
+		children[childCount++] = bvh.Nodes[binaryNode].Offset;
+	}
+
+	// pull the largest interior child's children up until the node is full
+	while (childCount < Width) {
+		int largest = -1;
+		float largestArea = -1.0f;
+		for (int i = 0; i < childCount; i++) {
+			if (isLeaf(children[i]))
+				continue;
+			float area = bvh.Nodes[children[i]].Bounds.SurfaceArea();
+			if (area > largestArea) {
+				largestArea = area;
+				largest = i;
+			}
+		}
+		if (largest < 0)
+			break;
+
+		uint32_t opened = children[largest];
+		children[largest] = opened + 1;
+		children[childCount++] = bvh.Nodes[opened].Offset;
+	}
+
+	{
+		WideBVHNode<Width>& node = Nodes[wideNode];
+		node.ChildCount = childCount;
+		for (int i = 0; i < Width; i++) {
+			// unused slots are masked out by ChildCount, keep them finite anyway
+			const Bounds3f bounds = i < childCount ? bvh.Nodes[children[i]].Bounds : Bounds3f(glm::vec3(0.0f));
+			node.MinX[i] = bounds.pMin.x; node.MinY[i] = bounds.pMin.y; node.MinZ[i] = bounds.pMin.z;
+			node.MaxX[i] = bounds.pMax.x; node.MaxY[i] = bounds.pMax.y; node.MaxZ[i] = bounds.pMax.z;
+			node.Child[i] = 0;
+			node.PrimitiveCount[i] = 0;
+			if (i < childCount && isLeaf(children[i])) {
+				node.Child[i] = bvh.Nodes[children[i]].Offset;
+				node.PrimitiveCount[i] = bvh.Nodes[children[i]].PrimitiveCount;
+			}
+		}
+	}
+
+	for (int i = 0; i < childCount; i++) {
+		if (isLeaf(children[i]))
+			continue;
+		uint32_t childIndex = (uint32_t)Nodes.size();
+		Nodes.emplace_back();
+		Nodes[wideNode].Child[i] = childIndex;
+		Collapse(bvh, children[i], childIndex);
+	}
+}
+
+#if RT_SIMD_X86
+
+template<>
+int WideBVH<4>::IntersectChildren(const WideBVHNode<4>& node, const glm::vec3& origin, const glm::vec3& invDir,
+		float tMin, float tMax, float* distances)
+{
+	const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+	const __m128 ix = _mm_set1_ps(invDir.x), iy = _mm_set1_ps(invDir.y), iz = _mm_set1_ps(invDir.z);
+
+	__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.MinX), ox), ix);
+	__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.MaxX), ox), ix);
+	__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.MinY), oy), iy);
+	__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.MaxY), oy), iy);
+	__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.MinZ), oz), iz);
+	__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.MaxZ), oz), iz);
+
+	__m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_set1_ps(tMin)));
+	__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(tMax)));
+
+	_mm_storeu_ps(distances, enter);
+	return _mm_movemask_ps(_mm_cmple_ps(enter, exit)) & ((1 << node.ChildCount) - 1);
+}
+
+template<>
+RT_TARGET_AVX2 int WideBVH<8>::IntersectChildren(const WideBVHNode<8>& node, const glm::vec3& origin, const glm::vec3& invDir,
+		float tMin, float tMax, float* distances)
+{
+	const __m256 ox = _mm256_set1_ps(origin.x), oy = _mm256_set1_ps(origin.y), oz = _mm256_set1_ps(origin.z);
+	const __m256 ix = _mm256_set1_ps(invDir.x), iy = _mm256_set1_ps(invDir.y), iz = _mm256_set1_ps(invDir.z);
+
+	__m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.MinX), ox), ix);
+	__m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.MaxX), ox), ix);
+	__m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.MinY), oy), iy);
+	__m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.MaxY), oy), iy);
+	__m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.MinZ), oz), iz);
+	__m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.MaxZ), oz), iz);
+
+	__m256 enter = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_max_ps(_mm256_min_ps(t0z, t1z), _mm256_set1_ps(tMin)));
+	__m256 exit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_min_ps(_mm256_max_ps(t0z, t1z), _mm256_set1_ps(tMax)));
+
+	_mm256_storeu_ps(distances, enter);
+	return _mm256_movemask_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ)) & ((1 << node.ChildCount) - 1);
+}
+
+#else // RT_SIMD_X86
+
+template<int Width>
+int WideBVH<Width>::IntersectChildren(const WideBVHNode<Width>& node, const glm::vec3& origin, const glm::vec3& invDir,
+		float tMin, float tMax, float* distances)
+{
+	int mask = 0;
+	for (uint32_t i = 0; i < node.ChildCount; i++) {
+		Bounds3f bounds(glm::vec3(node.MinX[i], node.MinY[i], node.MinZ[i]), glm::vec3(node.MaxX[i], node.MaxY[i], node.MaxZ[i]));
+		if (bounds.IntersectP(origin, invDir, tMin, tMax, distances[i]))
+			mask |= 1 << i;
+	}
+	return mask;
+}
+
+#endif // RT_SIMD_X86
+
+template class WideBVH<4>;
+template class WideBVH<8>;
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "RayTracer.h"
+#include "Ray.h"
+#include "Accel/BVH.h"
+#include "Accel/Simd.h"
+
+// Children are stored structure of arrays so all of them are slab tested with one set of SIMD instructions
+template<int Width>
+struct alignas(32) WideBVHNode
+{
+	float MinX[Width], MinY[Width], MinZ[Width];
+	float MaxX[Width], MaxY[Width], MaxZ[Width];
+	uint32_t Child[Width]; // node index for interior children, first primitive for leaves
+	uint32_t PrimitiveCount[Width]; // 0 for interior children
+	uint32_t ChildCount;
+};
+
+// 4 or 8 wide BVH made by collapsing the levels of a binary BVH, traversed with SSE (4) or AVX2 (8).
+// Width 8 must only be used when Simd::GetCPUFeatures().AVX2 is set.
+template<int Width>
+class WideBVH
+{
+public:
+	static_assert(Width == 4 || Width == 8, "WideBVH is either 4 or 8 wide");
+
+	void Build(const BVH& bvh);
+
+	// Same contract as BVH::Intersect
+	template<typename HitFn>
+	bool Intersect(const Ray& r, float tMin, float& tMax, HitFn&& hitLeaf) const;
+
+	// Same contract as BVH::Occluded
+	template<typename OccludedFn>
+	bool Occluded(const Ray& r, float tMin, float tMax, OccludedFn&& occludedLeaf) const;
+
+	bool Empty() const { return Nodes.empty(); }
+
+	std::vector<WideBVHNode<Width>> Nodes;
+	std::vector<uint32_t> PrimitiveIndices;
+
+private:
+	void Collapse(const BVH& bvh, uint32_t binaryNode, uint32_t wideNode);
+
+	// Slab tests every child of the node, returns a bit mask of the hit ones and their entry distances
+	static int IntersectChildren(const WideBVHNode<Width>& node, const glm::vec3& origin, const glm::vec3& invDir,
+			float tMin, float tMax, float* distances);
+};
+
+#if RT_SIMD_X86
+// SSE and AVX2 slab tests, defined in WideBVH.cpp
+template<>
+int WideBVH<4>::IntersectChildren(const WideBVHNode<4>& node, const glm::vec3& origin, const glm::vec3& invDir,
+		float tMin, float tMax, float* distances);
+template<>
+RT_TARGET_AVX2 int WideBVH<8>::IntersectChildren(const WideBVHNode<8>& node, const glm::vec3& origin, const glm::vec3& invDir,
+		float tMin, float tMax, float* distances);
+#endif
+
+template<int Width>
+template<typename HitFn>
+bool WideBVH<Width>::Intersect(const Ray& r, float tMin, float& tMax, HitFn&& hitLeaf) const
+{
+	if (Nodes.empty())
+		return false;
+
+	const glm::vec3 invDir = 1.0f / r.Direction;
+
+	struct StackEntry
+	{
+		uint32_t Index; // node, or first primitive of a leaf
+		uint32_t PrimitiveCount;
+		float Distance;
+	};
+	// every level replaces one entry with at most Width
+	StackEntry stack[BVH::MaxDepth * (Width - 1) + 1];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, 0, tMin };
+
+	bool hit = false;
+	while (stackSize > 0) {
+		const StackEntry entry = stack[--stackSize];
+		// a closer hit may have been found after this entry was pushed
+		if (entry.Distance > tMax)
+			continue;
+
+		if (entry.PrimitiveCount > 0) {
+			float hitDistance;
+			if (hitLeaf(entry.Index, entry.PrimitiveCount, tMin, tMax, hitDistance)) {
+				tMax = hitDistance;
+				hit = true;
+			}
+			continue;
+		}
+
+		const WideBVHNode<Width>& node = Nodes[entry.Index];
+		float distances[Width];
+		int mask = IntersectChildren(node, r.Origin, invDir, tMin, tMax, distances);
+		if (mask == 0)
+			continue;
+
+		// sort the hit children far to near, so the nearest ends up on top of the stack
+		StackEntry children[Width];
+		int childCount = 0;
+		while (mask) {
+			int i = Utils::CountTrailingZeros((uint32_t)mask);
+			mask &= mask - 1;
+
+			StackEntry child = { node.Child[i], node.PrimitiveCount[i], distances[i] };
+			int j = childCount++;
+			while (j > 0 && children[j - 1].Distance < child.Distance) {
+				children[j] = children[j - 1];
+				j--;
+			}
+			children[j] = child;
+		}
+
+		for (int i = 0; i < childCount; i++)
+			stack[stackSize++] = children[i];
+	}
+
+	return hit;
+}
+
+template<int Width>
+template<typename OccludedFn>
+bool WideBVH<Width>::Occluded(const Ray& r, float tMin, float tMax, OccludedFn&& occludedLeaf) const
+{
+	if (Nodes.empty())
+		return false;
+
+	const glm::vec3 invDir = 1.0f / r.Direction;
+
+	struct StackEntry
+	{
+		uint32_t Index; // node, or first primitive of a leaf
+		uint32_t PrimitiveCount;
+	};
+	StackEntry stack[BVH::MaxDepth * (Width - 1) + 1];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, 0 };
+
+	while (stackSize > 0) {
+		const StackEntry entry = stack[--stackSize];
+		if (entry.PrimitiveCount > 0) {
+			if (occludedLeaf(entry.Index, entry.PrimitiveCount, tMin, tMax))
+				return true;
+			continue;
+		}
+
+		// any hit child will do, so they are not sorted
+		const WideBVHNode<Width>& node = Nodes[entry.Index];
+		float distances[Width];
+		for (int mask = IntersectChildren(node, r.Origin, invDir, tMin, tMax, distances); mask; mask &= mask - 1) {
+			int i = Utils::CountTrailingZeros((uint32_t)mask);
+			stack[stackSize++] = { node.Child[i], node.PrimitiveCount[i] };
+		}
+	}
+
+	return false;
+}
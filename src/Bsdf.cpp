@@ -0,0 +1,263 @@
+#include "Bsdf.h"
+
+namespace {
+	inline float Sqr(float x)
+	{
+		return x * x;
+	}
+
+	// Trowbridge-Reitz (GGX) distribution of microfacet normals, isotropic, in the local frame
+	inline float GGXDistribution(const glm::vec3& wm, float alpha)
+	{
+		float cos2Theta = Sqr(wm.z);
+		float cos4Theta = Sqr(cos2Theta);
+		if (cos4Theta < 1e-16f)
+			return 0.0f;
+		float e = (1.0f - cos2Theta) / cos2Theta / Sqr(alpha);
+		return 1.0f / (Pi * Sqr(alpha) * cos4Theta * Sqr(1.0f + e));
+	}
+
+	// Smith's auxiliary function, the masking of a direction is 1 / (1 + Lambda)
+	inline float GGXLambda(const glm::vec3& w, float alpha)
+	{
+		float cos2Theta = Sqr(w.z);
+		if (cos2Theta < 1e-16f)
+			return 0.0f;
+		float tan2Theta = (1.0f - cos2Theta) / cos2Theta;
+		return (std::sqrt(1.0f + Sqr(alpha) * tan2Theta) - 1.0f) / 2.0f;
+	}
+
+	inline float GGXMasking(const glm::vec3& w, float alpha)
+	{
+		return 1.0f / (1.0f + GGXLambda(w, alpha));
+	}
+
+	// height correlated masking and shadowing
+	inline float GGXMaskingShadowing(const glm::vec3& wo, const glm::vec3& wi, float alpha)
+	{
+		return 1.0f / (1.0f + GGXLambda(wo, alpha) + GGXLambda(wi, alpha));
+	}
+
+	// Density of the normals visible from w
+	inline float GGXVisiblePdf(const glm::vec3& w, const glm::vec3& wm, float alpha)
+	{
+		return GGXMasking(w, alpha) / std::abs(w.z) * GGXDistribution(wm, alpha) * std::abs(glm::dot(w, wm));
+	}
+
+	// A normal visible from w, in the upper hemisphere
+	glm::vec3 SampleGGXVisible(const glm::vec3& w, float alpha, const glm::vec2& u)
+	{
+		// the hemisphere configuration, where the distribution is a unit hemisphere
+		glm::vec3 wh = glm::normalize(glm::vec3(alpha * w.x, alpha * w.y, w.z));
+		if (wh.z < 0.0f)
+			wh = -wh;
+		glm::vec3 t1 = wh.z < 0.99999f ? glm::normalize(glm::cross(glm::vec3(0.0f, 0.0f, 1.0f), wh)) : glm::vec3(1.0f, 0.0f, 0.0f);
+		glm::vec3 t2 = glm::cross(wh, t1);
+
+		// point on the disk, squeezed to the part of it that projects onto the visible half
+		float r = std::sqrt(u.x), phi = 2.0f * Pi * u.y;
+		glm::vec2 p(r * std::cos(phi), r * std::sin(phi));
+		float h = std::sqrt(1.0f - Sqr(p.x));
+		float s = (1.0f + wh.z) / 2.0f;
+		p.y = (1.0f - s) * h + s * p.y;
+		float pz = std::sqrt(std::max(0.0f, 1.0f - glm::dot(p, p)));
+		glm::vec3 nh = p.x * t1 + p.y * t2 + pz * wh;
+		return glm::normalize(glm::vec3(alpha * nh.x, alpha * nh.y, std::max(1e-6f, nh.z)));
+	}
+
+	// Unpolarized Fresnel reflectance of a dielectric interface, eta is the far side over the near side
+	inline float FresnelDielectric(float cosThetaI, float eta)
+	{
+		cosThetaI = glm::clamp(cosThetaI, -1.0f, 1.0f);
+		if (cosThetaI < 0.0f) {
+			eta = 1.0f / eta;
+			cosThetaI = -cosThetaI;
+		}
+		float sin2ThetaT = (1.0f - Sqr(cosThetaI)) / Sqr(eta);
+		if (sin2ThetaT >= 1.0f)
+			return 1.0f; // total internal reflection
+		float cosThetaT = std::sqrt(1.0f - sin2ThetaT);
+		float parallel = (eta * cosThetaI - cosThetaT) / (eta * cosThetaI + cosThetaT);
+		float perpendicular = (cosThetaI - eta * cosThetaT) / (cosThetaI + eta * cosThetaT);
+		return (Sqr(parallel) + Sqr(perpendicular)) / 2.0f;
+	}
+
+	inline glm::vec3 FresnelSchlick(const glm::vec3& f0, float cosTheta)
+	{
+		float m = 1.0f - glm::clamp(cosTheta, 0.0f, 1.0f);
+		return f0 + (glm::vec3(1.0f) - f0) * (m * m * m * m * m);
+	}
+
+	inline glm::vec3 Reflect(const glm::vec3& wo, const glm::vec3& n)
+	{
+		return -wo + 2.0f * glm::dot(wo, n) * n;
+	}
+
+	// Refracts wo, on the side n points to, through an interface with relative index eta. False on total internal
+	// reflection.
+	inline bool Refract(const glm::vec3& wo, const glm::vec3& n, float eta, glm::vec3& wt)
+	{
+		float cosThetaI = glm::dot(n, wo);
+		float sin2ThetaT = std::max(0.0f, 1.0f - Sqr(cosThetaI)) / Sqr(eta);
+		if (sin2ThetaT >= 1.0f)
+			return false;
+		float cosThetaT = std::sqrt(1.0f - sin2ThetaT);
+		wt = -wo / eta + (cosThetaI / eta - cosThetaT) * n;
+		return true;
+	}
+
+	// Microfacet normal of the half vector between wo and wi, either reflected or refracted, facing up. False for
+	// pairs no microfacet connects.
+	inline bool DielectricHalfVector(const glm::vec3& wo, const glm::vec3& wi, float eta, glm::vec3& wm)
+	{
+		float etap = wi.z > 0.0f ? 1.0f : eta;
+		wm = wi * etap + wo;
+		if (wi.z == 0.0f || glm::dot(wm, wm) == 0.0f)
+			return false;
+		wm = glm::normalize(wm);
+		if (wm.z < 0.0f)
+			wm = -wm;
+		// microfacets seen from behind
+		return glm::dot(wm, wi) * wi.z >= 0.0f && glm::dot(wm, wo) * wo.z >= 0.0f;
+	}
+}
+
+Bsdf::Bsdf(const Material& material, const glm::vec3& normal, bool frontFace)
+	: m_Normal(normal), m_Albedo(material.Albedo)
+{
+	Utils::OrthonormalBasis(m_Normal, m_Tangent, m_Bitangent);
+	m_Alpha = Sqr(glm::clamp(material.Roughness, 0.0f, 1.0f));
+	m_Eta = frontFace ? material.IOR : 1.0f / material.IOR;
+
+	float metallic = glm::clamp(material.Metallic, 0.0f, 1.0f), transmission = glm::clamp(material.Transmission, 0.0f, 1.0f);
+	m_Conductor = metallic;
+	m_Dielectric = (1.0f - metallic) * transmission;
+	m_Diffuse = (1.0f - metallic) * (1.0f - transmission);
+}
+
+glm::vec3 Bsdf::Evaluate(const glm::vec3& wo, const glm::vec3& wi) const
+{
+	return EvaluateLocal(ToLocal(wo), ToLocal(wi));
+}
+
+float Bsdf::Pdf(const glm::vec3& wo, const glm::vec3& wi) const
+{
+	return PdfLocal(ToLocal(wo), ToLocal(wi));
+}
+
+glm::vec3 Bsdf::EvaluateLocal(const glm::vec3& wo, const glm::vec3& wi) const
+{
+	if (wo.z <= 0.0f)
+		return glm::vec3(0.0f);
+
+	glm::vec3 f(0.0f);
+	bool reflected = wi.z > 0.0f;
+	if (m_Diffuse > 0.0f && reflected)
+		f += m_Diffuse * m_Albedo * InvPi;
+	if (IsSmooth())
+		return f;
+
+	if (m_Conductor > 0.0f && reflected) {
+		glm::vec3 wm = glm::normalize(wo + wi);
+		f += m_Conductor * GGXDistribution(wm, m_Alpha) * GGXMaskingShadowing(wo, wi, m_Alpha) / (4.0f * wo.z * wi.z)
+			* FresnelSchlick(m_Albedo, glm::dot(wo, wm));
+	}
+
+	glm::vec3 wm;
+	if (m_Dielectric > 0.0f && DielectricHalfVector(wo, wi, m_Eta, wm)) {
+		float fresnel = FresnelDielectric(glm::dot(wo, wm), m_Eta);
+		float dg = GGXDistribution(wm, m_Alpha) * GGXMaskingShadowing(wo, wi, m_Alpha);
+		if (reflected) {
+			f += glm::vec3(m_Dielectric * dg * fresnel / (4.0f * wo.z * wi.z));
+		} else {
+			// radiance is compressed into the smaller solid angle of the denser side, hence the 1 / eta^2
+			float denominator = Sqr(glm::dot(wi, wm) + glm::dot(wo, wm) / m_Eta) * wi.z * wo.z;
+			float transmitted = dg * (1.0f - fresnel) * std::abs(glm::dot(wi, wm) * glm::dot(wo, wm) / denominator) / Sqr(m_Eta);
+			f += m_Dielectric * transmitted * m_Albedo;
+		}
+	}
+	return f;
+}
+
+float Bsdf::PdfLocal(const glm::vec3& wo, const glm::vec3& wi) const
+{
+	if (wo.z <= 0.0f)
+		return 0.0f;
+
+	float pdf = 0.0f;
+	bool reflected = wi.z > 0.0f;
+	if (m_Diffuse > 0.0f && reflected)
+		pdf += m_Diffuse * wi.z * InvPi;
+	if (IsSmooth())
+		return pdf;
+
+	if (m_Conductor > 0.0f && reflected) {
+		glm::vec3 wm = glm::normalize(wo + wi);
+		pdf += m_Conductor * GGXVisiblePdf(wo, wm, m_Alpha) / (4.0f * std::abs(glm::dot(wo, wm)));
+	}
+
+	glm::vec3 wm;
+	if (m_Dielectric > 0.0f && DielectricHalfVector(wo, wi, m_Eta, wm)) {
+		// reflection is picked with the probability of the Fresnel reflectance
+		float fresnel = FresnelDielectric(glm::dot(wo, wm), m_Eta);
+		if (reflected) {
+			pdf += m_Dielectric * fresnel * GGXVisiblePdf(wo, wm, m_Alpha) / (4.0f * std::abs(glm::dot(wo, wm)));
+		} else {
+			float jacobian = std::abs(glm::dot(wi, wm)) / Sqr(glm::dot(wi, wm) + glm::dot(wo, wm) / m_Eta);
+			pdf += m_Dielectric * (1.0f - fresnel) * GGXVisiblePdf(wo, wm, m_Alpha) * jacobian;
+		}
+	}
+	return pdf;
+}
+
+bool Bsdf::Sample(const glm::vec3& worldWo, float uLobe, const glm::vec2& u, BsdfSample& sample) const
+{
+	glm::vec3 wo = ToLocal(worldWo);
+	if (wo.z <= 0.0f)
+		return false;
+
+	glm::vec3 wi;
+	sample.Specular = false;
+	if (uLobe < m_Diffuse) {
+		wi = Utils::SampleCosineHemisphere(glm::vec3(0.0f, 0.0f, 1.0f), u);
+	} else if (uLobe < m_Diffuse + m_Conductor || m_Dielectric == 0.0f) {
+		if (IsSmooth()) {
+			wi = glm::vec3(-wo.x, -wo.y, wo.z);
+			sample = { m_Conductor * FresnelSchlick(m_Albedo, wo.z) / wi.z, ToWorld(wi), m_Conductor, true };
+			return true;
+		}
+		wi = Reflect(wo, SampleGGXVisible(wo, m_Alpha, u));
+		if (wi.z <= 0.0f)
+			return false;
+	} else {
+		// what is left of uLobe chooses between reflection and refraction
+		float uFresnel = std::min((uLobe - m_Diffuse - m_Conductor) / m_Dielectric, 0.99999994f);
+		if (IsSmooth()) {
+			float fresnel = FresnelDielectric(wo.z, m_Eta);
+			if (uFresnel < fresnel) {
+				wi = glm::vec3(-wo.x, -wo.y, wo.z);
+				sample = { glm::vec3(m_Dielectric * fresnel / wi.z), ToWorld(wi), m_Dielectric * fresnel, true };
+			} else {
+				if (!Refract(wo, glm::vec3(0.0f, 0.0f, 1.0f), m_Eta, wi))
+					return false;
+				float transmitted = (1.0f - fresnel) / std::abs(wi.z) / Sqr(m_Eta);
+				sample = { m_Dielectric * transmitted * m_Albedo, ToWorld(wi), m_Dielectric * (1.0f - fresnel), true };
+			}
+			return true;
+		}
+		glm::vec3 wm = SampleGGXVisible(wo, m_Alpha, u);
+		if (uFresnel < FresnelDielectric(glm::dot(wo, wm), m_Eta)) {
+			wi = Reflect(wo, wm);
+			if (wi.z <= 0.0f)
+				return false;
+		} else if (!Refract(wo, wm, m_Eta, wi) || wi.z >= 0.0f) {
+			return false;
+		}
+	}
+
+	// every lobe that could have given wi, so the result does not depend on which one did
+	sample.Value = EvaluateLocal(wo, wi);
+	sample.Pdf = PdfLocal(wo, wi);
+	sample.Direction = ToWorld(wi);
+	return sample.Pdf > 0.0f;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "RayTracer.h"
+
+#include "Objects/Object.h"
+
+struct BsdfSample
+{
+	glm::vec3 Value; // f(wo, wi), the path throughput changes by Value * |cos(theta_i)| / Pdf
+	glm::vec3 Direction; // wi
+	float Pdf; // per unit solid angle, or the probability of the lobe for a specular sample
+	bool Specular; // from a perfectly smooth lobe, which Evaluate and Pdf leave out
+};
+
+// Scattering at a surface point, a mix of three lobes weighted by the Material:
+//   diffuse     (1 - Metallic) * (1 - Transmission), Lambertian reflection of Albedo
+//   conductor   Metallic, GGX microfacet reflection with Schlick's Fresnel towards Albedo
+//   dielectric  (1 - Metallic) * Transmission, GGX reflection and refraction at IOR, the refracted part tinted by Albedo
+// The GGX alpha is Roughness squared, below 1e-3 the microfacet lobes are perfectly smooth (delta) lobes.
+// Every direction is unit and points away from the surface, wo back along the incoming ray. Lobes are sampled with
+// the visible normals of Heitz 2018 and follow pbrt-v4's conductor and dielectric BxDFs.
+class Bsdf
+{
+public:
+	// normal faces wo, frontFace is whether wo is on the side the surface normal points to (outside)
+	Bsdf(const Material& material, const glm::vec3& normal, bool frontFace);
+
+	// f(wo, wi) of the lobes that are not smooth
+	glm::vec3 Evaluate(const glm::vec3& wo, const glm::vec3& wi) const;
+	// Density of Sample returning wi, over the lobes that are not smooth
+	float Pdf(const glm::vec3& wo, const glm::vec3& wi) const;
+	// uLobe in [0, 1) picks the lobe, then reflection or refraction, u the direction. False if the path is absorbed.
+	bool Sample(const glm::vec3& wo, float uLobe, const glm::vec2& u, BsdfSample& sample) const;
+
+	// Whether every lobe is smooth, sampled lights can never be reached through them
+	bool IsSpecular() const { return m_Diffuse == 0.0f && IsSmooth(); }
+
+	static constexpr float SmoothAlpha = 1e-3f;
+
+private:
+	bool IsSmooth() const { return m_Alpha < SmoothAlpha; }
+
+	// frame with the normal as z, wo is always in the upper hemisphere
+	glm::vec3 ToLocal(const glm::vec3& v) const { return { glm::dot(v, m_Tangent), glm::dot(v, m_Bitangent), glm::dot(v, m_Normal) }; }
+	glm::vec3 ToWorld(const glm::vec3& v) const { return m_Tangent * v.x + m_Bitangent * v.y + m_Normal * v.z; }
+
+	glm::vec3 EvaluateLocal(const glm::vec3& wo, const glm::vec3& wi) const;
+	float PdfLocal(const glm::vec3& wo, const glm::vec3& wi) const;
+
+	glm::vec3 m_Normal, m_Tangent, m_Bitangent;
+	glm::vec3 m_Albedo;
+	float m_Alpha;
+	float m_Eta; // index of refraction on the far side of the surface over the one on wo's side
+	float m_Diffuse, m_Conductor, m_Dielectric; // lobe probabilities, they sum to 1
+};
@@ -22,7 +22,6 @@ Camera::Camera(int image_width, float aspect_ratio, glm::vec3 origin)
 
 	CalculateProjectionMatrix();
 	CalculateViewMatrix();
-	RecalculateRayDirections();
 }
 
 void Camera::Resize(int width, int height) {
@@ -34,7 +33,6 @@ void Camera::Resize(int width, int height) {
 	m_AspectRatio = static_cast<float>(width) / static_cast<float>(height);
 
 	CalculateProjectionMatrix();
-	RecalculateRayDirections();
 }
 
 bool Camera::Update() {
@@ -88,28 +86,11 @@ bool Camera::Update() {
 	if (moved) {
 		CalculateViewMatrix();
 		CalculateProjectionMatrix();
-		RecalculateRayDirections();
 	}
 
 	return moved;
 }
 
-void Camera::RecalculateRayDirections() {
-	m_RayDirections.resize(m_Width * m_Height);
-
-	for (int y = 0; y < m_Height; y++) {
-		for (int x = 0; x < m_Width; x++) {
-			//float u = float(x + Utils::Randomfloat()) / (m_Width - 1);
-			//float v = float(y + Utils::Randomfloat()) / (m_Height - 1);
-			m_RayDirections[x + y * m_Width] = CalculateRayDirection({ x, y });
-		}
-	}
-}
-
-glm::vec3 Camera::GetRayDirection(glm::vec2&& coord) {
-	return m_RayDirections[(int)coord.x + (int)coord.y * m_Width];
-}
-
 void Camera::CalculateProjectionMatrix() {
 	const auto projection = glm::perspectiveFov(glm::radians(45.0f), (float)m_Width, (float)m_Height, 0.1f, 100.0f);
 	m_InverseProjection = glm::inverse(projection);
@@ -15,10 +15,6 @@ public:
 
 	void Resize(int width, int height);
 
-	void RecalculateRayDirections();
-
-	glm::vec3 GetRayDirection(glm::vec2&& coord);
-
 	void CalculateViewMatrix();
 	void CalculateProjectionMatrix();
 
@@ -34,7 +30,6 @@ private:
 	int m_Height;
 	float m_AspectRatio = 16.0f / 9.0f;
 
-	std::vector<glm::vec3> m_RayDirections;
 	glm::vec2 m_LastMousePosition = { 0, 0 };
 
 	glm::vec3 m_ForwardDirection = { 0, 0, 0 };
@@ -0,0 +1,502 @@
+#include "Denoiser.h"
+
+#include "Accel/Simd.h"
+
+#include <numeric>
+
+namespace {
+	// linear B-spline, the 3x3 kernel is its outer product
+	constexpr float Kernel[3] = { 0.25f, 0.5f, 0.25f };
+
+	// Edge stopping parameters of SVGF: the normal weight is the cosine to the power of 128, the depth and luminance
+	// weights fall off exponentially with the difference over its phi
+	constexpr int NormalPowerSquarings = 7;
+	constexpr float LuminancePhi = 4.0f; // standard deviations
+	constexpr float DepthPhi = 1.0f; // depth footprints per pixel of distance
+	constexpr float DepthEpsilon = 1e-4f;
+
+	// temporal variance needs this many samples, below it is estimated from the neighbours
+	constexpr float VarianceMinSamples = 4.0f;
+
+	// What the colour is divided by, channels that are nearly black (emitters in particular) are left alone
+	inline glm::vec3 Demodulation(float r, float g, float b)
+	{
+		return glm::vec3(r > 0.01f ? r : 1.0f, g > 0.01f ? g : 1.0f, b > 0.01f ? b : 1.0f);
+	}
+
+	// planes an iteration reads and writes
+	struct FilterView
+	{
+		const float *R, *G, *B, *Variance;
+		float *OutR, *OutG, *OutB, *OutVariance;
+		const float *NormalX, *NormalY, *NormalZ;
+		const float *Depth, *DepthFootprint;
+		uint32_t Width, Height, Step;
+	};
+
+	// Weight of the surface at q against the one at p from their normals, and the exponent of their depth weight
+	inline float GeometryWeight(const FilterView& v, size_t p, size_t q, float invPhiDepth, float& exponent)
+	{
+		float cosNormal = std::max(v.NormalX[p] * v.NormalX[q] + v.NormalY[p] * v.NormalY[q] + v.NormalZ[p] * v.NormalZ[q], 0.0f);
+		for (int k = 0; k < NormalPowerSquarings; k++)
+			cosNormal *= cosNormal;
+		exponent = std::abs(v.Depth[p] - v.Depth[q]) * invPhiDepth;
+		return cosNormal;
+	}
+
+	// 1 / phi of the depth weight for taps 1 and sqrt(2) steps away
+	inline void DepthPhis(const FilterView& v, size_t p, float invPhiDepth[2])
+	{
+		float phiDepth = DepthPhi * v.DepthFootprint[p] * v.Step;
+		invPhiDepth[0] = 1.0f / (phiDepth + DepthEpsilon);
+		invPhiDepth[1] = 1.0f / (phiDepth * 1.41421356f + DepthEpsilon);
+	}
+
+	// Variance of the pixel blurred with its 3x3 neighbours, it only steers the luminance weight
+	float PrefilteredVariance(const FilterView& v, uint32_t x, uint32_t y)
+	{
+		float sum = 0.0f, weights = 0.0f;
+		for (int j = -1; j <= 1; j++) {
+			int64_t yy = (int64_t)y + j;
+			if (yy < 0 || yy >= v.Height)
+				continue;
+			for (int i = -1; i <= 1; i++) {
+				int64_t xx = (int64_t)x + i;
+				if (xx < 0 || xx >= v.Width)
+					continue;
+				float w = Kernel[i + 1] * Kernel[j + 1];
+				sum += w * v.Variance[xx + yy * v.Width];
+				weights += w;
+			}
+		}
+		return sum / weights;
+	}
+
+	void FilterPixel(const FilterView& v, uint32_t x, uint32_t y)
+	{
+		const size_t p = x + (size_t)y * v.Width;
+		const glm::vec3 color(v.R[p], v.G[p], v.B[p]);
+		const float luminance = Utils::Luminance(color);
+		const float invPhiLuminance = 1.0f / (LuminancePhi * std::sqrt(PrefilteredVariance(v, x, y)) + 1e-6f);
+		float invPhiDepth[2];
+		DepthPhis(v, p, invPhiDepth);
+
+		const float centreWeight = Kernel[1] * Kernel[1];
+		glm::vec3 sum = color * centreWeight;
+		float weights = centreWeight, varianceSum = centreWeight * centreWeight * v.Variance[p];
+		for (int j = -1; j <= 1; j++) {
+			int64_t yy = (int64_t)y + j * (int64_t)v.Step;
+			if (yy < 0 || yy >= v.Height)
+				continue;
+			for (int i = -1; i <= 1; i++) {
+				int64_t xx = (int64_t)x + i * (int64_t)v.Step;
+				if ((i == 0 && j == 0) || xx < 0 || xx >= v.Width)
+					continue;
+				const size_t q = xx + yy * v.Width;
+				float exponent;
+				float w = GeometryWeight(v, p, q, invPhiDepth[i != 0 && j != 0], exponent);
+				if (w == 0.0f)
+					continue;
+
+				const glm::vec3 colorQ(v.R[q], v.G[q], v.B[q]);
+				exponent += std::abs(luminance - Utils::Luminance(colorQ)) * invPhiLuminance;
+				w *= Kernel[i + 1] * Kernel[j + 1] * std::exp(-exponent);
+				sum += colorQ * w;
+				weights += w;
+				varianceSum += w * w * v.Variance[q];
+			}
+		}
+
+		sum /= weights;
+		v.OutR[p] = sum.x;
+		v.OutG[p] = sum.y;
+		v.OutB[p] = sum.z;
+		v.OutVariance[p] = varianceSum / (weights * weights);
+	}
+
+	// Luminance variance of the 3x3 neighbours on the same surface
+	float EstimateVariance(const FilterView& v, const float* luminance, uint32_t x, uint32_t y)
+	{
+		const size_t p = x + (size_t)y * v.Width;
+		float invPhiDepth[2];
+		DepthPhis(v, p, invPhiDepth);
+
+		float sum = luminance[p], squares = luminance[p] * luminance[p], weights = 1.0f;
+		for (int j = -1; j <= 1; j++) {
+			int64_t yy = (int64_t)y + j;
+			if (yy < 0 || yy >= v.Height)
+				continue;
+			for (int i = -1; i <= 1; i++) {
+				int64_t xx = (int64_t)x + i;
+				if ((i == 0 && j == 0) || xx < 0 || xx >= v.Width)
+					continue;
+				const size_t q = xx + yy * v.Width;
+				float exponent;
+				float w = GeometryWeight(v, p, q, invPhiDepth[i != 0 && j != 0], exponent) * std::exp(-exponent);
+				sum += w * luminance[q];
+				squares += w * luminance[q] * luminance[q];
+				weights += w;
+			}
+		}
+		sum /= weights;
+		return std::max(squares / weights - sum * sum, 0.0f);
+	}
+
+#if RT_SIMD_X86
+
+	// e^-x for x >= 0 as 2^(-x log2 e), the power of the fraction from its Taylor polynomial, within 6e-5. The
+	// weights need no more, Cephes' expf took half the time of an iteration.
+	RT_TARGET_AVX2 inline __m256 ExpNegativeAVX2(__m256 x)
+	{
+		// min returns the second operand for a NaN
+		__m256 t = _mm256_mul_ps(_mm256_min_ps(x, _mm256_set1_ps(87.0f)), _mm256_set1_ps(-1.44269504f));
+		__m256 n = _mm256_round_ps(t, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m256 f = _mm256_sub_ps(t, n);
+
+		__m256 y = _mm256_set1_ps(9.6181291e-3f);
+		y = _mm256_fmadd_ps(y, f, _mm256_set1_ps(5.5504109e-2f));
+		y = _mm256_fmadd_ps(y, f, _mm256_set1_ps(2.4022651e-1f));
+		y = _mm256_fmadd_ps(y, f, _mm256_set1_ps(6.9314718e-1f));
+		y = _mm256_fmadd_ps(y, f, _mm256_set1_ps(1.0f));
+
+		// times 2^n, built from the exponent bits
+		__m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+		return _mm256_mul_ps(y, _mm256_castsi256_ps(exponent));
+	}
+
+	RT_TARGET_AVX2 inline __m256 AbsAVX2(__m256 x)
+	{
+		return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+	}
+
+	RT_TARGET_AVX2 inline __m256 LuminanceAVX2(__m256 r, __m256 g, __m256 b)
+	{
+		return _mm256_fmadd_ps(r, _mm256_set1_ps(0.2126f), _mm256_fmadd_ps(g, _mm256_set1_ps(0.7152f), _mm256_mul_ps(b, _mm256_set1_ps(0.0722f))));
+	}
+
+	// Centre of a span of 8 pixels, what GeometryWeight needs of it
+	struct SpanSurface
+	{
+		__m256 NormalX, NormalY, NormalZ, Depth;
+		__m256 InvPhiDepth[2];
+	};
+
+	RT_TARGET_AVX2 inline SpanSurface LoadSpanSurface(const FilterView& v, size_t p)
+	{
+		SpanSurface s;
+		s.NormalX = _mm256_loadu_ps(v.NormalX + p);
+		s.NormalY = _mm256_loadu_ps(v.NormalY + p);
+		s.NormalZ = _mm256_loadu_ps(v.NormalZ + p);
+		s.Depth = _mm256_loadu_ps(v.Depth + p);
+		const __m256 phiDepth = _mm256_mul_ps(_mm256_loadu_ps(v.DepthFootprint + p), _mm256_set1_ps(DepthPhi * v.Step));
+		s.InvPhiDepth[0] = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_add_ps(phiDepth, _mm256_set1_ps(DepthEpsilon)));
+		s.InvPhiDepth[1] = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_fmadd_ps(phiDepth, _mm256_set1_ps(1.41421356f), _mm256_set1_ps(DepthEpsilon)));
+		return s;
+	}
+
+	RT_TARGET_AVX2 inline __m256 GeometryWeightAVX2(const FilterView& v, const SpanSurface& s, size_t q, bool diagonal, __m256& exponent)
+	{
+		__m256 cosNormal = _mm256_mul_ps(s.NormalX, _mm256_loadu_ps(v.NormalX + q));
+		cosNormal = _mm256_fmadd_ps(s.NormalY, _mm256_loadu_ps(v.NormalY + q), cosNormal);
+		cosNormal = _mm256_fmadd_ps(s.NormalZ, _mm256_loadu_ps(v.NormalZ + q), cosNormal);
+		__m256 w = _mm256_max_ps(cosNormal, _mm256_setzero_ps());
+		for (int k = 0; k < NormalPowerSquarings; k++)
+			w = _mm256_mul_ps(w, w);
+		exponent = _mm256_mul_ps(AbsAVX2(_mm256_sub_ps(s.Depth, _mm256_loadu_ps(v.Depth + q))), s.InvPhiDepth[diagonal]);
+		return w;
+	}
+
+	// FilterPixel for the 8 pixels from x on, every tap of which has to be inside the image horizontally
+	RT_TARGET_AVX2 void FilterSpanAVX2(const FilterView& v, uint32_t x, uint32_t y)
+	{
+		const size_t p = x + (size_t)y * v.Width;
+		const __m256 r = _mm256_loadu_ps(v.R + p), g = _mm256_loadu_ps(v.G + p), b = _mm256_loadu_ps(v.B + p);
+		const __m256 luminance = LuminanceAVX2(r, g, b);
+		const SpanSurface surface = LoadSpanSurface(v, p);
+
+		__m256 blurred = _mm256_setzero_ps();
+		float blurWeights = 0.0f;
+		for (int j = -1; j <= 1; j++) {
+			int64_t yy = (int64_t)y + j;
+			if (yy < 0 || yy >= v.Height)
+				continue;
+			const float* row = v.Variance + x + yy * v.Width;
+			__m256 sides = _mm256_add_ps(_mm256_loadu_ps(row - 1), _mm256_loadu_ps(row + 1));
+			__m256 blurredRow = _mm256_fmadd_ps(sides, _mm256_set1_ps(Kernel[0]), _mm256_mul_ps(_mm256_loadu_ps(row), _mm256_set1_ps(Kernel[1])));
+			blurred = _mm256_fmadd_ps(blurredRow, _mm256_set1_ps(Kernel[j + 1]), blurred);
+			blurWeights += Kernel[j + 1];
+		}
+		blurred = _mm256_max_ps(_mm256_mul_ps(blurred, _mm256_set1_ps(1.0f / blurWeights)), _mm256_setzero_ps());
+		const __m256 invPhiLuminance = _mm256_div_ps(_mm256_set1_ps(1.0f),
+				_mm256_fmadd_ps(_mm256_sqrt_ps(blurred), _mm256_set1_ps(LuminancePhi), _mm256_set1_ps(1e-6f)));
+
+		const __m256 centreWeight = _mm256_set1_ps(Kernel[1] * Kernel[1]);
+		__m256 sumR = _mm256_mul_ps(r, centreWeight), sumG = _mm256_mul_ps(g, centreWeight), sumB = _mm256_mul_ps(b, centreWeight);
+		__m256 weights = centreWeight;
+		__m256 varianceSum = _mm256_mul_ps(_mm256_mul_ps(centreWeight, centreWeight), _mm256_loadu_ps(v.Variance + p));
+		for (int j = -1; j <= 1; j++) {
+			int64_t yy = (int64_t)y + j * (int64_t)v.Step;
+			if (yy < 0 || yy >= v.Height)
+				continue;
+			for (int i = -1; i <= 1; i++) {
+				if (i == 0 && j == 0)
+					continue;
+				const size_t q = x + i * (int64_t)v.Step + yy * v.Width;
+				__m256 exponent;
+				__m256 w = GeometryWeightAVX2(v, surface, q, i != 0 && j != 0, exponent);
+
+				const __m256 rq = _mm256_loadu_ps(v.R + q), gq = _mm256_loadu_ps(v.G + q), bq = _mm256_loadu_ps(v.B + q);
+				exponent = _mm256_fmadd_ps(AbsAVX2(_mm256_sub_ps(luminance, LuminanceAVX2(rq, gq, bq))), invPhiLuminance, exponent);
+				w = _mm256_mul_ps(_mm256_mul_ps(w, _mm256_set1_ps(Kernel[i + 1] * Kernel[j + 1])), ExpNegativeAVX2(exponent));
+
+				sumR = _mm256_fmadd_ps(rq, w, sumR);
+				sumG = _mm256_fmadd_ps(gq, w, sumG);
+				sumB = _mm256_fmadd_ps(bq, w, sumB);
+				weights = _mm256_add_ps(weights, w);
+				varianceSum = _mm256_fmadd_ps(_mm256_mul_ps(w, w), _mm256_loadu_ps(v.Variance + q), varianceSum);
+			}
+		}
+
+		const __m256 invWeights = _mm256_div_ps(_mm256_set1_ps(1.0f), weights);
+		_mm256_storeu_ps(v.OutR + p, _mm256_mul_ps(sumR, invWeights));
+		_mm256_storeu_ps(v.OutG + p, _mm256_mul_ps(sumG, invWeights));
+		_mm256_storeu_ps(v.OutB + p, _mm256_mul_ps(sumB, invWeights));
+		_mm256_storeu_ps(v.OutVariance + p, _mm256_mul_ps(varianceSum, _mm256_mul_ps(invWeights, invWeights)));
+	}
+
+	// EstimateVariance for the 8 pixels from x on, written to variance, x - 1 and x + 8 have to be inside the row
+	RT_TARGET_AVX2 void EstimateVarianceSpanAVX2(const FilterView& v, const float* luminance, uint32_t x, uint32_t y, float* variance)
+	{
+		const size_t p = x + (size_t)y * v.Width;
+		const SpanSurface surface = LoadSpanSurface(v, p);
+
+		__m256 sum = _mm256_loadu_ps(luminance + p);
+		__m256 squares = _mm256_mul_ps(sum, sum);
+		__m256 weights = _mm256_set1_ps(1.0f);
+		for (int j = -1; j <= 1; j++) {
+			int64_t yy = (int64_t)y + j;
+			if (yy < 0 || yy >= v.Height)
+				continue;
+			for (int i = -1; i <= 1; i++) {
+				if (i == 0 && j == 0)
+					continue;
+				const size_t q = x + i + yy * v.Width;
+				__m256 exponent;
+				__m256 w = GeometryWeightAVX2(v, surface, q, i != 0 && j != 0, exponent);
+				w = _mm256_mul_ps(w, ExpNegativeAVX2(exponent));
+				const __m256 l = _mm256_loadu_ps(luminance + q);
+				sum = _mm256_fmadd_ps(w, l, sum);
+				squares = _mm256_fmadd_ps(_mm256_mul_ps(w, l), l, squares);
+				weights = _mm256_add_ps(weights, w);
+			}
+		}
+		const __m256 invWeights = _mm256_div_ps(_mm256_set1_ps(1.0f), weights);
+		sum = _mm256_mul_ps(sum, invWeights);
+		__m256 result = _mm256_fnmadd_ps(sum, sum, _mm256_mul_ps(squares, invWeights));
+		_mm256_storeu_ps(variance + p, _mm256_max_ps(result, _mm256_setzero_ps()));
+	}
+
+#endif // RT_SIMD_X86
+}
+
+void Denoiser::Resize(uint32_t width, uint32_t height)
+{
+	m_Width = width;
+	m_Height = height;
+	size_t pixelCount = (size_t)width * height;
+	for (Planes& planes : m_Planes) {
+		planes.R.resize(pixelCount);
+		planes.G.resize(pixelCount);
+		planes.B.resize(pixelCount);
+		planes.Variance.resize(pixelCount);
+	}
+	m_Luminance.resize(pixelCount);
+	for (std::vector<float>* feature : { &m_AlbedoR, &m_AlbedoG, &m_AlbedoB, &m_NormalX, &m_NormalY, &m_NormalZ, &m_Depth, &m_DepthFootprint })
+		feature->assign(pixelCount, 0.0f);
+
+	m_Bands.resize((height + BandHeight - 1) / BandHeight);
+	std::iota(m_Bands.begin(), m_Bands.end(), 0);
+	m_UseAVX2 = Simd::GetCPUFeatures().AVX2;
+}
+
+void Denoiser::SetFeatures(uint32_t pixel, const glm::vec3& albedo, const glm::vec3& normal, float depth)
+{
+	m_AlbedoR[pixel] = albedo.x;
+	m_AlbedoG[pixel] = albedo.y;
+	m_AlbedoB[pixel] = albedo.z;
+	m_NormalX[pixel] = normal.x;
+	m_NormalY[pixel] = normal.y;
+	m_NormalZ[pixel] = normal.z;
+	m_Depth[pixel] = depth;
+}
+
+void Denoiser::ClearFeatures(uint32_t pixel)
+{
+	SetFeatures(pixel, glm::vec3(0.0f), glm::vec3(0.0f), 0.0f);
+}
+
+void Denoiser::CommitFeatures(ThreadPool& pool)
+{
+	pool.Run(m_Bands, [this](uint32_t band) {
+			uint32_t y0 = band * BandHeight;
+			FootprintRows(y0, std::min(y0 + BandHeight, m_Height));
+			});
+}
+
+void Denoiser::Filter(ThreadPool& pool, const glm::vec4* accumulation, const float* luminanceSquares, int iterations, uint32_t* output)
+{
+	auto rows = [this](uint32_t band, uint32_t& y0, uint32_t& y1) {
+		y0 = band * BandHeight;
+		y1 = std::min(y0 + BandHeight, m_Height);
+	};
+
+	pool.Run(m_Bands, [&](uint32_t band) {
+			uint32_t y0, y1;
+			rows(band, y0, y1);
+			LoadRows(accumulation, luminanceSquares, y0, y1);
+			});
+	pool.Run(m_Bands, [&](uint32_t band) {
+			uint32_t y0, y1;
+			rows(band, y0, y1);
+			EstimateVarianceRows(accumulation, y0, y1);
+			});
+
+	iterations = std::clamp(iterations, 1, MaxIterations);
+	for (int i = 0; i < iterations; i++) {
+		pool.Run(m_Bands, [&](uint32_t band) {
+				uint32_t y0, y1;
+				rows(band, y0, y1);
+				FilterRows(m_Planes[i % 2], m_Planes[(i + 1) % 2], 1u << i, y0, y1);
+				});
+	}
+
+	pool.Run(m_Bands, [&](uint32_t band) {
+			uint32_t y0, y1;
+			rows(band, y0, y1);
+			StoreRows(output, m_Planes[iterations % 2], y0, y1);
+			});
+}
+
+void Denoiser::LoadRows(const glm::vec4* accumulation, const float* luminanceSquares, uint32_t y0, uint32_t y1)
+{
+	Planes& planes = m_Planes[0];
+	for (uint32_t y = y0; y < y1; y++) {
+		for (uint32_t x = 0; x < m_Width; x++) {
+			const size_t p = x + (size_t)y * m_Width;
+			const float n = accumulation[p].w, invN = 1.0f / n;
+			const glm::vec3 demodulation = Demodulation(m_AlbedoR[p], m_AlbedoG[p], m_AlbedoB[p]);
+			const glm::vec3 mean = glm::vec3(accumulation[p]) * invN;
+			const glm::vec3 lighting = mean / demodulation;
+			planes.R[p] = lighting.x;
+			planes.G[p] = lighting.y;
+			planes.B[p] = lighting.z;
+			m_Luminance[p] = Utils::Luminance(lighting);
+			if (n >= VarianceMinSamples) {
+				// of the mean rather than of a single sample, the luminance of the lighting is taken to be the one
+				// of the colour over the albedo's
+				float meanLuminance = Utils::Luminance(mean), demodulationLuminance = Utils::Luminance(demodulation);
+				float variance = std::max(luminanceSquares[p] * invN - meanLuminance * meanLuminance, 0.0f) / (n - 1.0f);
+				planes.Variance[p] = variance / (demodulationLuminance * demodulationLuminance);
+			}
+		}
+	}
+}
+
+void Denoiser::FootprintRows(uint32_t y0, uint32_t y1)
+{
+	for (uint32_t y = y0; y < y1; y++) {
+		for (uint32_t x = 0; x < m_Width; x++) {
+			const size_t p = x + (size_t)y * m_Width;
+			// Smallest depth step to a horizontal and a vertical neighbour on a surface, the larger one is usually
+			// across a silhouette. SVGF uses the screen space depth gradient.
+			auto step = [&](int64_t xx, int64_t yy) {
+				if (xx < 0 || xx >= m_Width || yy < 0 || yy >= m_Height)
+					return std::numeric_limits<float>::infinity();
+				size_t q = xx + yy * m_Width;
+				if (m_NormalX[q] == 0.0f && m_NormalY[q] == 0.0f && m_NormalZ[q] == 0.0f)
+					return std::numeric_limits<float>::infinity();
+				return std::abs(m_Depth[p] - m_Depth[q]);
+			};
+			float dx = std::min(step((int64_t)x - 1, y), step((int64_t)x + 1, y));
+			float dy = std::min(step(x, (int64_t)y - 1), step(x, (int64_t)y + 1));
+			m_DepthFootprint[p] = (std::isinf(dx) ? 0.0f : dx) + (std::isinf(dy) ? 0.0f : dy);
+		}
+	}
+}
+
+void Denoiser::EstimateVarianceRows(const glm::vec4* accumulation, uint32_t y0, uint32_t y1)
+{
+	FilterView v = {};
+	v.NormalX = m_NormalX.data();
+	v.NormalY = m_NormalY.data();
+	v.NormalZ = m_NormalZ.data();
+	v.Depth = m_Depth.data();
+	v.DepthFootprint = m_DepthFootprint.data();
+	v.Width = m_Width;
+	v.Height = m_Height;
+	v.Step = 1;
+	float* variance = m_Planes[0].Variance.data();
+
+	for (uint32_t y = y0; y < y1; y++) {
+		const glm::vec4* row = accumulation + (size_t)y * m_Width;
+		uint32_t x = 0;
+#if RT_SIMD_X86
+		// whole spans at once where none of the pixels has enough samples, always the case for the first few passes
+		if (m_UseAVX2 && m_Width > 2) {
+			for (x = 1; x + 8 <= m_Width - 1; x += 8) {
+				bool temporal = false;
+				for (uint32_t i = x; i < x + 8; i++)
+					temporal |= row[i].w >= VarianceMinSamples;
+				if (!temporal)
+					EstimateVarianceSpanAVX2(v, m_Luminance.data(), x, y, variance);
+				else {
+					for (uint32_t i = x; i < x + 8; i++) {
+						if (row[i].w < VarianceMinSamples)
+							variance[i + (size_t)y * m_Width] = EstimateVariance(v, m_Luminance.data(), i, y);
+					}
+				}
+			}
+			if (row[0].w < VarianceMinSamples)
+				variance[(size_t)y * m_Width] = EstimateVariance(v, m_Luminance.data(), 0, y);
+		}
+#endif
+		for (; x < m_Width; x++) {
+			if (row[x].w < VarianceMinSamples)
+				variance[x + (size_t)y * m_Width] = EstimateVariance(v, m_Luminance.data(), x, y);
+		}
+	}
+}
+
+void Denoiser::StoreRows(uint32_t* output, const Planes& result, uint32_t y0, uint32_t y1) const
+{
+	for (size_t p = (size_t)y0 * m_Width; p < (size_t)y1 * m_Width; p++) {
+		glm::vec3 color = glm::vec3(result.R[p], result.G[p], result.B[p]) * Demodulation(m_AlbedoR[p], m_AlbedoG[p], m_AlbedoB[p]);
+		output[p] = Utils::Vec3ToUInt32(glm::clamp(color, glm::vec3(0.0f), glm::vec3(1.0f)));
+	}
+}
+
+void Denoiser::FilterRows(const Planes& source, Planes& destination, uint32_t step, uint32_t y0, uint32_t y1) const
+{
+	const FilterView v = {
+		source.R.data(), source.G.data(), source.B.data(), source.Variance.data(),
+		destination.R.data(), destination.G.data(), destination.B.data(), destination.Variance.data(),
+		m_NormalX.data(), m_NormalY.data(), m_NormalZ.data(),
+		m_Depth.data(), m_DepthFootprint.data(),
+		m_Width, m_Height, step
+	};
+
+	// the SIMD spans need every tap inside the row, only the pixels near the left and right edge are left over
+	for (uint32_t y = y0; y < y1; y++) {
+		uint32_t x = 0;
+#if RT_SIMD_X86
+		if (m_UseAVX2 && m_Width > 2 * step) {
+			for (; x < step; x++)
+				FilterPixel(v, x, y);
+			for (; x + 8 <= m_Width - step; x += 8)
+				FilterSpanAVX2(v, x, y);
+		}
+#endif
+		for (; x < m_Width; x++)
+			FilterPixel(v, x, y);
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "RayTracer.h"
+
+#include "ThreadPool.h"
+
+// Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) for the CPU image, with the variance guided luminance
+// weight of SVGF (Schied et al. 2017). Each iteration applies a 3x3 B-spline kernel with its taps spread twice as far
+// as the last one, 5 iterations reach 31 pixels. The taps are weighted down across edges of the first hit's normal
+// and depth, and where two pixels differ by more than their noise explains. As in SVGF the colour is divided by the
+// first hit's albedo before filtering and multiplied back after, so material edges stay sharp while the lighting is
+// blurred across them. Only the shown image is filtered, the accumulation is left alone.
+// Every stage runs on the thread pool in bands of rows. A few ms at 1280x720 takes several cores: on one core of the
+// test machine (1.3G 8-wide FMAs/s) an iteration takes 12-16 ms, loading and storing the image about 5 ms each.
+class Denoiser
+{
+public:
+	void Resize(uint32_t width, uint32_t height);
+
+	// Features of the surface seen through a pixel's centre, written by the renderer's G-buffer pass
+	void SetFeatures(uint32_t pixel, const glm::vec3& albedo, const glm::vec3& normal, float depth);
+	// The pixel sees nothing, it is never mixed with its neighbours
+	void ClearFeatures(uint32_t pixel);
+	// Call once the features of every pixel are set, what is derived from them is kept for every Filter until then
+	void CommitFeatures(ThreadPool& pool);
+
+	// Filters the average of every pixel's samples and writes it to output as RGBA8. accumulation holds the sum of
+	// the samples and their count in w, luminanceSquares the sum of their squared luminance. Every pixel needs at
+	// least one sample. iterations from 1 to MaxIterations.
+	void Filter(ThreadPool& pool, const glm::vec4* accumulation, const float* luminanceSquares, int iterations, uint32_t* output);
+
+	static constexpr int MaxIterations = 5;
+	// 3 reach 7 pixels, the last two iterations cost as much again and mostly blur low frequency noise
+	static constexpr int DefaultIterations = 3;
+
+private:
+	// lighting (colour over albedo) and the variance of its luminance, one plane per channel so 8 neighbouring pixels
+	// load at once
+	struct Planes
+	{
+		std::vector<float> R, G, B, Variance;
+	};
+
+	void LoadRows(const glm::vec4* accumulation, const float* luminanceSquares, uint32_t y0, uint32_t y1);
+	void FootprintRows(uint32_t y0, uint32_t y1);
+	// The variance of pixels with too few samples of their own is estimated from their neighbours
+	void EstimateVarianceRows(const glm::vec4* accumulation, uint32_t y0, uint32_t y1);
+	// Multiplies the albedo back in
+	void StoreRows(uint32_t* output, const Planes& result, uint32_t y0, uint32_t y1) const;
+	// One iteration with the taps step pixels apart
+	void FilterRows(const Planes& source, Planes& destination, uint32_t step, uint32_t y0, uint32_t y1) const;
+
+	uint32_t m_Width = 0, m_Height = 0;
+	std::vector<uint32_t> m_Bands; // rows of BandHeight handed to the threads
+	static constexpr uint32_t BandHeight = 8;
+
+	Planes m_Planes[2]; // ping-ponged between the iterations
+	std::vector<float> m_Luminance; // of the unfiltered lighting, for the variance estimate
+
+	// G-buffer, a zero normal marks a pixel that sees nothing
+	std::vector<float> m_AlbedoR, m_AlbedoG, m_AlbedoB;
+	std::vector<float> m_NormalX, m_NormalY, m_NormalZ;
+	std::vector<float> m_Depth;
+	std::vector<float> m_DepthFootprint; // how much the depth changes from one pixel to the next
+
+	bool m_UseAVX2 = false;
+};
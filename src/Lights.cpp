@@ -0,0 +1,177 @@
+#include "Lights.h"
+
+#include "Objects/Mesh.h"
+#include "Objects/Sphere.h"
+#include "Objects/Triangle.h"
+
+void AliasTable::Build(const std::vector<float>& weights)
+{
+	m_Entries.clear();
+	double total = 0.0;
+	for (float weight : weights)
+		total += weight;
+	if (weights.empty() || total <= 0.0)
+		return;
+
+	// Slots start with n times their probability. Every step tops up a slot below 1 from one above, which then
+	// is its alias, so each slot ends up shared by at most two items.
+	uint32_t count = (uint32_t)weights.size();
+	m_Entries.resize(count);
+	std::vector<double> scaled(count);
+	std::vector<uint32_t> small, large;
+	for (uint32_t i = 0; i < count; i++) {
+		m_Entries[i] = { 1.0f, i, (float)(weights[i] / total) };
+		scaled[i] = weights[i] / total * count;
+		(scaled[i] < 1.0 ? small : large).push_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		uint32_t less = small.back(), more = large.back();
+		small.pop_back();
+		m_Entries[less].Probability = (float)scaled[less];
+		m_Entries[less].Alias = more;
+		scaled[more] -= 1.0 - scaled[less];
+		if (scaled[more] < 1.0) {
+			large.pop_back();
+			small.push_back(more);
+		}
+	}
+	// whatever is left is 1 up to rounding
+	for (uint32_t i : small)
+		m_Entries[i].Probability = 1.0f;
+	for (uint32_t i : large)
+		m_Entries[i].Probability = 1.0f;
+}
+
+void LightList::Build(const Scene& scene, const std::vector<Material>& materials)
+{
+	m_Lights.clear();
+	m_ObjectLights.assign(scene.Objects.size(), -1);
+	for (int i = 0; i < (int)scene.Objects.size(); i++) {
+		const Object* object = scene.Objects[i];
+		const Material& material = materials[object->MaterialIndex];
+		glm::vec3 emission = material.EmissionColor * material.EmissionStrength;
+		if (Utils::Luminance(emission) <= 0.0f)
+			continue;
+
+		auto addTriangle = [&](const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2) {
+			float area = 0.5f * glm::length(glm::cross(v1 - v0, v2 - v0));
+			if (area > 0.0f)
+				m_Lights.push_back({ LightType::Triangle, { v0, v1, v2 }, 0.0f, emission, area, i });
+		};
+
+		switch (object->GetType()) {
+			case ObjectType::Sphere: {
+				auto sphere = dynamic_cast<const Sphere*>(object);
+				if (sphere->Radius > 0.0f)
+					m_Lights.push_back({ LightType::Sphere, { sphere->Origin }, sphere->Radius, emission, 4.0f * Pi * sphere->Radius * sphere->Radius, i });
+				break;
+			}
+			case ObjectType::Triangle: {
+				auto triangle = dynamic_cast<const Triangle*>(object);
+				addTriangle(triangle->Vertices[0], triangle->Vertices[1], triangle->Vertices[2]);
+				break;
+			}
+			case ObjectType::Mesh: {
+				auto mesh = dynamic_cast<const Mesh*>(object);
+				glm::vec3 translation = mesh->GetTranslation();
+				for (size_t t = 0; t < mesh->GetTriangleCount(); t++) {
+					MeshTriangle triangle = mesh->GetTriangle(t);
+					addTriangle(triangle[0] + translation, triangle[1] + translation, triangle[2] + translation);
+				}
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	std::vector<float> power(m_Lights.size());
+	m_TotalPower = 0.0f;
+	for (size_t i = m_Lights.size(); i-- > 0;) {
+		power[i] = Utils::Luminance(m_Lights[i].Emission) * m_Lights[i].Area;
+		m_TotalPower += power[i];
+		m_ObjectLights[m_Lights[i].ObjectIndex] = (int)i;
+	}
+	m_Table.Build(power);
+}
+
+bool LightList::Sample(const glm::vec3& position, float uLight, const glm::vec2& uPoint, LightSample& sample) const
+{
+	if (m_Table.Empty())
+		return false;
+
+	uint32_t index = m_Table.Sample(uLight);
+	const Light& light = m_Lights[index];
+	sample.Emission = light.Emission;
+	sample.ObjectIndex = light.ObjectIndex;
+
+	if (light.Type == LightType::Sphere) {
+		// uniform over the cone of directions the sphere covers
+		glm::vec3 toCenter = light.Vertices[0] - position;
+		float distanceSquared = glm::dot(toCenter, toCenter);
+		float radiusSquared = light.Radius * light.Radius;
+		if (distanceSquared <= radiusSquared)
+			return false;
+
+		float distance = std::sqrt(distanceSquared);
+		float sinThetaMaxSquared = radiusSquared / distanceSquared;
+		float cosThetaMax = std::sqrt(1.0f - sinThetaMaxSquared);
+		// 1 - cosThetaMax without cancelling when the sphere is small or far away
+		float solidAngle = 2.0f * Pi * sinThetaMaxSquared / (1.0f + cosThetaMax);
+
+		float cosTheta = 1.0f - uPoint.x * (1.0f - cosThetaMax);
+		float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+		float phi = 2.0f * Pi * uPoint.y;
+		glm::vec3 axis = toCenter / distance, tangent, bitangent;
+		Utils::OrthonormalBasis(axis, tangent, bitangent);
+		sample.Direction = glm::normalize(axis * cosTheta + (tangent * std::cos(phi) + bitangent * std::sin(phi)) * sinTheta);
+
+		// near intersection of the direction with the sphere
+		float b = glm::dot(toCenter, sample.Direction);
+		sample.Distance = b - std::sqrt(std::max(0.0f, radiusSquared - (distanceSquared - b * b)));
+		sample.Pdf = m_Table.GetPdf(index) / solidAngle;
+		return true;
+	}
+
+	// uniform over the area of the triangle, turned into a solid angle density
+	float su = std::sqrt(uPoint.x);
+	glm::vec3 point = light.Vertices[0] * (1.0f - su) + light.Vertices[1] * (su * (1.0f - uPoint.y)) + light.Vertices[2] * (su * uPoint.y);
+	glm::vec3 toLight = point - position;
+	float distanceSquared = glm::dot(toLight, toLight);
+	if (distanceSquared <= 0.0f)
+		return false;
+
+	sample.Distance = std::sqrt(distanceSquared);
+	sample.Direction = toLight / sample.Distance;
+	glm::vec3 normal = glm::normalize(glm::cross(light.Vertices[1] - light.Vertices[0], light.Vertices[2] - light.Vertices[0]));
+	float cosLight = std::abs(glm::dot(normal, sample.Direction));
+	if (cosLight <= 1e-6f)
+		return false;
+
+	sample.Pdf = m_Table.GetPdf(index) * distanceSquared / (cosLight * light.Area);
+	return true;
+}
+
+float LightList::GetPdf(int objectIndex, const glm::vec3& origin, const glm::vec3& position, const glm::vec3& normal) const
+{
+	int index = m_ObjectLights[objectIndex];
+	const Light& light = m_Lights[index];
+	if (light.Type == LightType::Sphere) {
+		glm::vec3 toCenter = light.Vertices[0] - origin;
+		float distanceSquared = glm::dot(toCenter, toCenter);
+		float radiusSquared = light.Radius * light.Radius;
+		if (distanceSquared <= radiusSquared)
+			return 0.0f;
+		float sinThetaMaxSquared = radiusSquared / distanceSquared;
+		float solidAngle = 2.0f * Pi * sinThetaMaxSquared / (1.0f + std::sqrt(1.0f - sinThetaMaxSquared));
+		return m_Table.GetPdf(index) / solidAngle;
+	}
+
+	// picking a triangle by power and a point on it uniformly is uniform over the object's area
+	glm::vec3 toLight = position - origin;
+	float distanceSquared = glm::dot(toLight, toLight);
+	float cosLight = std::abs(glm::dot(normal, toLight)) / std::sqrt(distanceSquared);
+	if (cosLight <= 1e-6f)
+		return 0.0f;
+	return Utils::Luminance(light.Emission) * distanceSquared / (cosLight * m_TotalPower);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "RayTracer.h"
+
+#include "Scene.h"
+
+// Picks one of n items in constant time with probability proportional to its weight (Vose's alias method)
+class AliasTable
+{
+public:
+	struct Entry
+	{
+		float Probability; // of keeping this slot rather than taking its alias
+		uint32_t Alias;
+		float Pdf; // probability of picking this item overall
+	};
+
+	// Items with zero weight are never picked, all zero picks nothing
+	void Build(const std::vector<float>& weights);
+
+	// u in [0, 1), the fraction left after choosing the slot decides between it and its alias
+	uint32_t Sample(float u) const {
+		float scaled = u * m_Entries.size();
+		uint32_t slot = std::min((uint32_t)scaled, (uint32_t)m_Entries.size() - 1);
+		return scaled - slot < m_Entries[slot].Probability ? slot : m_Entries[slot].Alias;
+	}
+	float GetPdf(uint32_t index) const { return m_Entries[index].Pdf; }
+
+	bool Empty() const { return m_Entries.empty(); }
+	const std::vector<Entry>& GetEntries() const { return m_Entries; }
+
+private:
+	std::vector<Entry> m_Entries;
+};
+
+enum class LightType
+{
+	Triangle,
+	Sphere
+};
+
+// An emissive surface, triangles emit from both sides
+struct Light
+{
+	LightType Type;
+	glm::vec3 Vertices[3]; // world space, a sphere's center in Vertices[0]
+	float Radius;
+	glm::vec3 Emission; // emitted radiance
+	float Area;
+	int ObjectIndex;
+};
+
+struct LightSample
+{
+	glm::vec3 Direction; // unit, from the shaded point to the light
+	float Distance;
+	glm::vec3 Emission;
+	float Pdf; // per unit solid angle at the shaded point, including the choice of light
+	int ObjectIndex;
+};
+
+// Every emissive sphere, triangle and mesh triangle of a scene, chosen by the power they emit. Planes and boxes
+// are not sampled, they are still seen by paths that hit them.
+class LightList
+{
+public:
+	void Build(const Scene& scene, const std::vector<Material>& materials);
+
+	// Picks a light and a point on it as seen from position, false if that point cannot light it
+	bool Sample(const glm::vec3& position, float uLight, const glm::vec2& uPoint, LightSample& sample) const;
+
+	// Density per unit solid angle of Sample picking the point position, with the given normal, of a sampled object
+	// as seen from origin. Every triangle of an object has the same emission, so its density does not depend on
+	// which one it is.
+	float GetPdf(int objectIndex, const glm::vec3& origin, const glm::vec3& position, const glm::vec3& normal) const;
+
+	bool Empty() const { return m_Lights.empty(); }
+	size_t GetCount() const { return m_Lights.size(); }
+	// Whether the object's light is sampled, paths that hit emitters which are not have to count them
+	bool IsSampled(int objectIndex) const { return objectIndex < (int)m_ObjectLights.size() && m_ObjectLights[objectIndex] >= 0; }
+
+private:
+	std::vector<Light> m_Lights;
+	std::vector<int> m_ObjectLights; // first light of every object, -1 if it has none
+	AliasTable m_Table;
+	float m_TotalPower = 0.0f;
+};
@@ -9,7 +9,7 @@ class Bounds2
 		Bounds2()
 		{
 			T minNum = std::numeric_limits<T>::lowest();
-			T maxNum = std::numeric_limits<T>::lowest();
+			T maxNum = std::numeric_limits<T>::max();
 			pMin = glm::vec2(maxNum, maxNum);
 			pMax = glm::vec2(minNum, minNum);
 		}
@@ -43,7 +43,7 @@ class Bounds3
 		Bounds3()
 		{
 			T minNum = std::numeric_limits<T>::lowest();
-			T maxNum = std::numeric_limits<T>::lowest();
+			T maxNum = std::numeric_limits<T>::max();
 			pMin = glm::vec3(maxNum, maxNum, maxNum);
 			pMax = glm::vec3(minNum, minNum, minNum);
 		}
@@ -66,6 +66,69 @@ class Bounds3
 			return min + direction * 0.5f;
 		}
 
+		glm::vec3 Diagonal() const { return pMax - pMin; }
+
+		T SurfaceArea() const
+		{
+			glm::vec3 d = Diagonal();
+			return 2 * (d.x * d.y + d.x * d.z + d.y * d.z);
+		}
+
+		// index of the longest axis
+		int MaximumExtent() const
+		{
+			glm::vec3 d = Diagonal();
+			if (d.x > d.y && d.x > d.z)
+				return 0;
+			else if (d.y > d.z)
+				return 1;
+			else
+				return 2;
+		}
+
+		// position of p relative to the corners, (0, 0, 0) at pMin and (1, 1, 1) at pMax
+		glm::vec3 Offset(const glm::vec3& p) const
+		{
+			glm::vec3 o = p - pMin;
+			if (pMax.x > pMin.x) o.x /= pMax.x - pMin.x;
+			if (pMax.y > pMin.y) o.y /= pMax.y - pMin.y;
+			if (pMax.z > pMin.z) o.z /= pMax.z - pMin.z;
+			return o;
+		}
+
+		// Slab test against a ray given its precomputed inverse direction, tHit is the entry distance
+		bool IntersectP(const glm::vec3& origin, const glm::vec3& invDir, float tMin, float tMax, float& tHit) const
+		{
+			glm::vec3 t0 = (pMin - origin) * invDir;
+			glm::vec3 t1 = (pMax - origin) * invDir;
+			glm::vec3 tNear = glm::min(t0, t1);
+			glm::vec3 tFar = glm::max(t0, t1);
+
+			float enter = std::max(tMin, std::max(tNear.x, std::max(tNear.y, tNear.z)));
+			float exit = std::min(tMax, std::min(tFar.x, std::min(tFar.y, tFar.z)));
+
+			tHit = enter;
+			return enter <= exit;
+		}
+
 	public:
 		glm::vec3 pMin, pMax;
 };
+
+template<typename T>
+inline Bounds3<T> Union(const Bounds3<T>& b, const glm::vec3& p)
+{
+	Bounds3<T> ret;
+	ret.pMin = glm::min(b.pMin, p);
+	ret.pMax = glm::max(b.pMax, p);
+	return ret;
+}
+
+template<typename T>
+inline Bounds3<T> Union(const Bounds3<T>& b1, const Bounds3<T>& b2)
+{
+	Bounds3<T> ret;
+	ret.pMin = glm::min(b1.pMin, b2.pMin);
+	ret.pMax = glm::max(b1.pMax, b2.pMax);
+	return ret;
+}
@@ -20,3 +20,14 @@ bool Box::Hit(const Ray& r, float tMin, float tMax, float& hitDistance) const
     hitDistance = tmin;
     return tmax >= std::max(0.0f, tmin);
 }
+
+glm::vec3 Box::GetNormal(const Ray& r, float hitDistance) const
+{
+    // the face the point is closest to, relative to the size of the box
+    glm::vec3 offset = (r.At(hitDistance) - m_Box.Center()) / glm::max(m_Box.Diagonal() * 0.5f, glm::vec3(1e-6f));
+    glm::vec3 distance = glm::abs(offset);
+    int axis = distance.x > distance.y ? (distance.x > distance.z ? 0 : 2) : (distance.y > distance.z ? 1 : 2);
+    glm::vec3 normal(0.0f);
+    normal[axis] = offset[axis] < 0.0f ? -1.0f : 1.0f;
+    return normal;
+}
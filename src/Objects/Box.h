@@ -14,6 +14,10 @@ public:
 
 	virtual ObjectType GetType() const override { return ObjectType::BoundingBox; }
 
+	virtual glm::vec3 GetNormal(const Ray& r, float hitDistance) const override;
+
+	virtual Bounds3f GetBounds() const override { return m_Box; }
+
 public:
 	Bounds3<float> m_Box;
 };
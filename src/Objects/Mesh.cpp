@@ -1,50 +1,166 @@
 #include "Mesh.h"
 
+#include "Accel/Simd.h"
+
 #include <fstream>
 #include <chrono>
 
 Mesh::Mesh(const std::string& filename, const int&& material_index) : Object(glm::vec3(1.0f), material_index), BoundingBox(Bounds3f(glm::vec3(0.0f), glm::vec3(0.0f)), std::move(material_index)) {
 	LoadFromOBJ(filename);
+	BuildBVH();
 	CalculateBoundingBox();
 }
 
+template<typename LeafFn>
+bool Mesh::Traverse(const Ray& localRay, float tMin, float& tMax, LeafFn&& leaf) const
+{
+	if (m_BVHLayout == BVHLayout::Quantized)
+		return m_QuantizedBVH.Intersect(localRay, tMin, tMax, leaf);
+	switch (m_BVHWidth) {
+		case 8: return m_BVH8.Intersect(localRay, tMin, tMax, leaf);
+		case 4: return m_BVH4.Intersect(localRay, tMin, tMax, leaf);
+		default: return m_BVH.Intersect(localRay, tMin, tMax, leaf);
+	}
+}
+
+template<typename LeafFn>
+bool Mesh::TraverseOccluded(const Ray& localRay, float tMin, float tMax, LeafFn&& leaf) const
+{
+	if (m_BVHLayout == BVHLayout::Quantized)
+		return m_QuantizedBVH.Occluded(localRay, tMin, tMax, leaf);
+	switch (m_BVHWidth) {
+		case 8: return m_BVH8.Occluded(localRay, tMin, tMax, leaf);
+		case 4: return m_BVH4.Occluded(localRay, tMin, tMax, leaf);
+		default: return m_BVH.Occluded(localRay, tMin, tMax, leaf);
+	}
+}
+
 bool Mesh::Hit(const Ray& r, float tMin, float tMax, float& hitDistance) const
 {
-	if (!BoundingBox.Hit(r, tMin, tMax, hitDistance))
-		return false;
+	// a translation leaves ray distances unchanged, so only the origin has to go to object space
+	const Ray localRay(r.Origin - m_Translation, r.Direction);
 
-	hitDistance = 0;
-	for (const auto& tri : MeshTriangles) {
-		float tempHitDistance;
-		if (tri.Hit(r, tMin, tMax, tempHitDistance)) {
-			if (hitDistance == 0 || tempHitDistance < hitDistance) {
-				hitDistance = tempHitDistance;
-				return true;
-			}
-		}
+	const TriangleRay triangleRay(localRay);
+	auto hitTriangle = [&](uint32_t first, uint32_t count, float tMin, float tMax, float& tempHitDistance) {
+		return m_TriangleData.IntersectLeaf(triangleRay, first, count, tMin, tMax, tempHitDistance);
+	};
+
+	float closestDistance = tMax;
+	bool hit = Traverse(localRay, tMin, closestDistance, hitTriangle);
+	if (hit)
+		hitDistance = closestDistance;
+	return hit;
+}
+
+bool Mesh::Occluded(const Ray& r, float tMin, float tMax) const
+{
+	const Ray localRay(r.Origin - m_Translation, r.Direction);
+	const TriangleRay triangleRay(localRay);
+	return TraverseOccluded(localRay, tMin, tMax, [&](uint32_t first, uint32_t count, float tMin, float tMax) {
+			return m_TriangleData.OccludedLeaf(triangleRay, first, count, tMin, tMax);
+			});
+}
+
+glm::vec3 Mesh::GetNormal(const Ray& r, float hitDistance) const
+{
+	const Ray localRay(r.Origin - m_Translation, r.Direction);
+	const TriangleRay triangleRay(localRay);
+	uint32_t lane = std::numeric_limits<uint32_t>::max();
+	auto hitTriangle = [&](uint32_t first, uint32_t count, float tMin, float tMax, float& tempHitDistance) {
+		return m_TriangleData.IntersectLeaf(triangleRay, first, count, tMin, tMax, tempHitDistance, &lane);
+	};
+
+	// only the nodes around the hit point overlap the interval, so this visits a path or two down the tree
+	float slack = std::max(hitDistance * 1e-4f, 1e-6f);
+	float closestDistance = hitDistance + slack;
+	Traverse(localRay, hitDistance - slack, closestDistance, hitTriangle);
+	return lane != std::numeric_limits<uint32_t>::max() ? m_TriangleData.GetNormal(lane) : -r.Direction;
+}
+
+uint64_t Mesh::IntersectPacket(RayPacket& packet, float tMin, uint64_t rayMask) const
+{
+	if (!packet.Coherent || m_BVH.Empty())
+		return Object::IntersectPacket(packet, tMin, rayMask);
+
+	const glm::vec3 localOrigin = packet.Origin - m_Translation;
+	TriangleRay triangleRays[RayPacket::MaxSize];
+	for (uint64_t mask = rayMask; mask; mask &= mask - 1) {
+		int i = Utils::CountTrailingZeros64(mask);
+		triangleRays[i] = TriangleRay(Ray(localOrigin, packet.Directions[i]));
 	}
-	return false;
+
+	return m_BVH.IntersectPacket(localOrigin, packet, tMin, rayMask, [&](uint32_t first, uint32_t count, uint64_t rays) {
+			uint64_t hits = 0;
+			for (; rays; rays &= rays - 1) {
+				int i = Utils::CountTrailingZeros64(rays);
+				float hitDistance;
+				if (m_TriangleData.IntersectLeaf(triangleRays[i], first, count, tMin, packet.TMax[i], hitDistance)) {
+					packet.TMax[i] = hitDistance;
+					hits |= 1ull << i;
+				}
+			}
+			return hits;
+			});
 }
 
 void Mesh::MoveTo(const glm::vec3& newOrigin) {
-	// Calculate offset
-	glm::vec3 offset = newOrigin - Origin;
+	m_Translation += newOrigin - Origin;
 
-	// Move all triangles by offset
-	for (auto& tri : MeshTriangles) {
-		for (int i = 0; i < 3; i++) {
-			tri.Vertices[i] += offset;
-		}
-		tri.Origin += offset;
+	// Recalculate bounding box after moving
+	CalculateBoundingBox();
+}
+
+void Mesh::UpdateVertex(uint32_t vertex, BVHBuildMode mode) {
+	// the compressed layout has no binary BVH left to refit
+	if (m_BVHLayout == BVHLayout::Quantized) {
+		BuildBVH(mode);
+		CalculateBoundingBox();
+		return;
 	}
 
-	// Update origin
-	Origin = newOrigin;
+	if (m_VertexTriangleOffsets.empty())
+		BuildVertexTriangles();
+
+	for (uint32_t i = m_VertexTriangleOffsets[vertex]; i < m_VertexTriangleOffsets[vertex + 1]; i++) {
+		uint32_t triangle = m_VertexTriangles[i];
+		MeshTriangle tri = GetTriangle(triangle);
+		const glm::vec3 v[3] = { tri[0], tri[1], tri[2] };
+		m_TriangleData.Update(triangle, v);
+		m_BVH.Refit(triangle, [this](uint32_t t) { return GetTriangle(t).GetBounds(); });
+	}
+	m_LocalBounds = m_BVH.GetBounds();
+	bool degraded = m_BVH.GetCostRatio() > RefitCostThreshold;
+	bool replaceLinear = mode == BVHBuildMode::SAH && m_BVHBuildMode == BVHBuildMode::Linear;
+	if (degraded || replaceLinear)
+		BuildBVH(mode);
+	else if (mode == BVHBuildMode::Linear)
+		m_BVHWidth = 2; // traverse the refit binary BVH until the edit is done, collapsing it again is O(n)
+	else
+		BuildTraversalBVH();
 
-	// Recalculate bounding box after moving
 	CalculateBoundingBox();
 }
 
+void Mesh::SetBVHLayout(BVHLayout layout) {
+	if (layout == m_BVHLayout)
+		return;
+
+	m_BVHLayout = layout;
+	// the quantized layout dropped the binary BVH, so build from scratch
+	BuildBVH();
+}
+
+size_t Mesh::GetTriangleBytes() const {
+	return Vertices.size() * sizeof(glm::vec3) + Indices.size() * sizeof(uint32_t) + m_TriangleData.GetBytes();
+}
+
+size_t Mesh::GetAccelerationBytes() const {
+	return m_BVH.Nodes.size() * sizeof(BVHNode) + m_BVH.PrimitiveIndices.size() * sizeof(uint32_t)
+		+ m_BVH4.Nodes.size() * sizeof(WideBVHNode<4>) + m_BVH4.PrimitiveIndices.size() * sizeof(uint32_t)
+		+ m_BVH8.Nodes.size() * sizeof(WideBVHNode<8>) + m_BVH8.PrimitiveIndices.size() * sizeof(uint32_t)
+		+ m_QuantizedBVH.Nodes.size() * sizeof(QuantizedBVHNode) + m_QuantizedBVH.PrimitiveIndices.size() * sizeof(uint32_t);
+}
+
 bool Mesh::LoadFromOBJ(const std::string& filename) {
 	std::chrono::time_point <std::chrono::high_resolution_clock> start, end;
 	start = std::chrono::high_resolution_clock::now();
@@ -65,59 +181,34 @@ bool Mesh::LoadFromOBJ(const std::string& filename) {
 			iss >> vertex.x >> vertex.y >> vertex.z;
 			Vertices.push_back(vertex);
 		} else if (type == "f") {
-			glm::vec3 triangle;
-			std::string v1, v2, v3;
-			iss >> v1 >> v2 >> v3;
+			std::string v[3];
+			iss >> v[0] >> v[1] >> v[2];
 
-			// Extract just the vertex indices (before the first '/')
-			triangle.x = std::stoi(v1.substr(0, v1.find('/'))) - 1;
-			triangle.y = std::stoi(v2.substr(0, v2.find('/'))) - 1;
-			triangle.z = std::stoi(v3.substr(0, v3.find('/'))) - 1;
-
-			Triangles.push_back(triangle);
+			// Extract just the vertex indices (before the first '/'), negative ones become out of bounds below
+			for (int k = 0; k < 3; k++)
+				Indices.push_back((uint32_t)(std::stol(v[k].substr(0, v[k].find('/'))) - 1));
 		}
 	}
 	file.close();
 
-	for (const auto& tri : Triangles) {
-		if (tri.x >= Vertices.size() || tri.y >= Vertices.size() || tri.z >= Vertices.size()) {
-			fprintf(stderr, "Index out of bounds in OBJ file: Vertices[%d], Vertices[%d], Vertices[%d] | Vertices.size() == %zu", 
-					(int)tri.x, (int)tri.y, (int)tri.z, Vertices.size());
+	for (size_t i = 0; i < Indices.size(); i += 3) {
+		if (Indices[i] >= Vertices.size() || Indices[i + 1] >= Vertices.size() || Indices[i + 2] >= Vertices.size()) {
+			fprintf(stderr, "Index out of bounds in OBJ file: Vertices[%d], Vertices[%d], Vertices[%d] | Vertices.size() == %zu\n",
+					(int)Indices[i], (int)Indices[i + 1], (int)Indices[i + 2], Vertices.size());
+			Indices.clear();
 			return false;
 		}
-		glm::vec3 v[3] = { Vertices[(int)tri.x], Vertices[(int)tri.y], Vertices[(int)tri.z] };
-		MeshTriangles.emplace_back(v, MaterialIndex);
 	}
 	end = std::chrono::high_resolution_clock::now();
 	long duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-	printf("Loaded %zu vertices and %zu triangles from %s in %ldus\n", Vertices.size(), Triangles.size(), filename.c_str(), duration);
+	printf("Loaded %zu vertices and %zu triangles from %s in %ldus\n", Vertices.size(), GetTriangleCount(), filename.c_str(), duration);
 	return true;
 }
 
 void Mesh::CalculateBoundingBox() {
-	// Start with extreme values
-	glm::vec3 min(std::numeric_limits<float>::max());
-	glm::vec3 max(std::numeric_limits<float>::lowest());
-
-	// Check ALL vertices in all triangles
-	for (const auto& tri : MeshTriangles) {
-		for (int i = 0; i < 3; i++) {
-			// Expand AABB to include each vertex
-			min.x = std::min(min.x, tri.Vertices[i].x);
-			min.y = std::min(min.y, tri.Vertices[i].y);
-			min.z = std::min(min.z, tri.Vertices[i].z);
-
-			max.x = std::max(max.x, tri.Vertices[i].x);
-			max.y = std::max(max.y, tri.Vertices[i].y);
-			max.z = std::max(max.z, tri.Vertices[i].z);
-		}
-	}
-
-	// Check for empty mesh
-	if (MeshTriangles.empty()) {
-		min = glm::vec3(0.0f);
-		max = glm::vec3(0.0f);
-	}
+	// The BVH root already bounds every triangle
+	glm::vec3 min = m_LocalBounds.pMin + m_Translation;
+	glm::vec3 max = m_LocalBounds.pMax + m_Translation;
 
 	// Create bounding box
 	BoundingBox = Box(Bounds3<float>(min, max), std::move(MaterialIndex));
@@ -125,3 +216,74 @@ void Mesh::CalculateBoundingBox() {
 	// Update origin to center of box
 	Origin = (min + max) * 0.5f;
 }
+
+void Mesh::BuildBVH(BVHBuildMode mode) {
+	std::chrono::time_point <std::chrono::high_resolution_clock> start, end;
+	start = std::chrono::high_resolution_clock::now();
+
+	std::vector<Bounds3f> triangleBounds;
+	triangleBounds.reserve(GetTriangleCount());
+	for (size_t i = 0; i < GetTriangleCount(); i++) {
+		triangleBounds.push_back(GetTriangle(i).GetBounds());
+	}
+
+	// leaves hold as many triangles as the intersection kernel tests at once
+	TriangleKernel kernel = TriangleData::GetDefaultKernel();
+	m_BVH.Build(triangleBounds, mode, 0, TriangleData::GetPacketWidth(kernel));
+	m_BVHBuildMode = mode;
+	m_LocalBounds = m_BVH.Empty() ? Bounds3f(glm::vec3(0.0f)) : m_BVH.GetBounds();
+	size_t nodeCount = m_BVH.Nodes.size();
+	m_TriangleData.Build(m_BVH, [this](uint32_t triangle, glm::vec3 v[3]) {
+			MeshTriangle tri = GetTriangle(triangle);
+			for (int k = 0; k < 3; k++)
+				v[k] = tri[k];
+			}, kernel);
+	BuildTraversalBVH();
+
+	end = std::chrono::high_resolution_clock::now();
+	long duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	// linear builds happen every frame while editing, only report the full ones
+	if (mode == BVHBuildMode::Linear)
+		return;
+
+	double trianglesPerSecond = duration > 0 ? GetTriangleCount() * 1e6 / duration : 0.0;
+	const char* layout = m_BVHLayout == BVHLayout::Quantized ? "quantized 4" : m_BVHWidth == 8 ? "8" : m_BVHWidth == 4 ? "4" : "2";
+	double bytesPerTriangle = GetTriangleCount() == 0 ? 0.0 : (double)GetAccelerationBytes() / GetTriangleCount();
+	printf("Built BVH with %zu nodes over %zu triangles in %ldus (%.2fM triangles/s), traversing it %s wide at %.1f bytes/triangle\n",
+			nodeCount, GetTriangleCount(), duration, trianglesPerSecond * 1e-6, layout, bytesPerTriangle);
+}
+
+void Mesh::BuildTraversalBVH() {
+	// drop whatever layout was traversed before
+	m_BVH4 = WideBVH<4>();
+	m_BVH8 = WideBVH<8>();
+	m_QuantizedBVH = QuantizedBVH();
+
+	if (m_BVHLayout == BVHLayout::Quantized) {
+		WideBVH<4> wide;
+		wide.Build(m_BVH);
+		m_QuantizedBVH.Build(wide);
+		m_BVH = BVH();
+		return;
+	}
+
+	m_BVHWidth = Simd::GetBVHWidth();
+	if (m_BVHWidth == 8)
+		m_BVH8.Build(m_BVH);
+	else if (m_BVHWidth == 4)
+		m_BVH4.Build(m_BVH);
+}
+
+void Mesh::BuildVertexTriangles() {
+	// counting sort of the triangles by the vertices they use
+	m_VertexTriangleOffsets.assign(Vertices.size() + 1, 0);
+	for (uint32_t index : Indices)
+		m_VertexTriangleOffsets[index + 1]++;
+	for (size_t v = 0; v < Vertices.size(); v++)
+		m_VertexTriangleOffsets[v + 1] += m_VertexTriangleOffsets[v];
+
+	m_VertexTriangles.resize(Indices.size());
+	std::vector<uint32_t> next(m_VertexTriangleOffsets.begin(), m_VertexTriangleOffsets.end() - 1);
+	for (size_t i = 0; i < Indices.size(); i++)
+		m_VertexTriangles[next[Indices[i]]++] = (uint32_t)(i / 3);
+}
@@ -5,6 +5,32 @@
 #include "Object.h"
 #include <Objects/Triangle.h>
 #include <Objects/Box.h>
+#include <Accel/BVH.h>
+#include <Accel/WideBVH.h>
+#include <Accel/QuantizedBVH.h>
+
+enum class BVHLayout
+{
+	Wide, // widest nodes the CPU can test at once, keeps the binary BVH around for refits
+	Quantized // compressed 4 wide nodes, drops the binary BVH so edits rebuild instead of refit
+};
+
+// Non-virtual view of one mesh triangle: three indices into the mesh's shared vertex buffer
+struct MeshTriangle
+{
+	const glm::vec3* Vertices;
+	const uint32_t* Index;
+
+	const glm::vec3& operator[](int k) const { return Vertices[Index[k]]; }
+
+	glm::vec3 GetNormal() const { return glm::normalize(glm::cross((*this)[1] - (*this)[0], (*this)[2] - (*this)[0])); }
+
+	Bounds3f GetBounds() const { return Union(Bounds3f((*this)[0], (*this)[1]), (*this)[2]); }
+
+	bool Hit(const Ray& r, float& hitDistance) const {
+		return IntersectTriangle(TriangleRay(r), (*this)[0], (*this)[1], (*this)[2], hitDistance) && hitDistance >= 0.0f;
+	}
+};
 
 class Mesh : public Object {
 public:
@@ -12,15 +38,72 @@ public:
 
 	virtual bool Hit(const Ray& r, float tMin, float tMax, float& hitDistance) const override;
 
+	// Ends at the first triangle hit, whichever leaf it is in
+	virtual bool Occluded(const Ray& r, float tMin, float tMax) const override;
+
+	// Coherent packets go through the binary BVH together, the quantized layout has none and tests one ray at a time
+	virtual uint64_t IntersectPacket(RayPacket& packet, float tMin, uint64_t rayMask) const override;
+
 	virtual ObjectType GetType() const override { return ObjectType::Mesh; }
 
+	// Normal of the triangle hit, found by traversing again in a narrow interval around the hit
+	virtual glm::vec3 GetNormal(const Ray& r, float hitDistance) const override;
+
+	virtual Bounds3f GetBounds() const override { return BoundingBox.m_Box; }
+
+	// Rigid move, only updates the mesh translation. The triangles and their BVH stay in object space.
 	void MoveTo(const glm::vec3& newOrigin);
 
-	std::vector<glm::vec3> Vertices;
-	std::vector<glm::vec3> Triangles;
-	std::vector<Triangle> MeshTriangles;
+	// Call after editing an (object space) vertex in place. The BVH is refit along the paths to every triangle
+	// sharing that vertex and only rebuilt once its cost grows past RefitCostThreshold. While an edit is being
+	// dragged use the linear build mode, it is fast enough to rebuild every frame, and the binary BVH is traversed so
+	// only the refit paths are touched; pass SAH once the edit is done, which collapses it to the wide layout again and
+	// also replaces a tree that was rebuilt linearly during the edit.
+	void UpdateVertex(uint32_t vertex, BVHBuildMode mode = BVHBuildMode::SAH);
+
+	MeshTriangle GetTriangle(size_t index) const { return { Vertices.data(), &Indices[3 * index] }; }
+	size_t GetTriangleCount() const { return Indices.size() / 3; }
+
+	glm::vec3 GetTranslation() const { return m_Translation; }
+
+	void SetBVHLayout(BVHLayout layout);
+	BVHLayout GetBVHLayout() const { return m_BVHLayout; }
+
+	size_t GetTriangleBytes() const;
+	size_t GetAccelerationBytes() const;
+
+	std::vector<glm::vec3> Vertices; // object space, offset by GetTranslation() in the world
+	std::vector<uint32_t> Indices; // three per triangle
 	Box BoundingBox;
+
+	// SAH cost of the refit BVH relative to its last build that triggers a rebuild
+	float RefitCostThreshold = 1.5f;
 private:
+	// Closest hit of an object space ray through the layout that is traversed
+	template<typename LeafFn>
+	bool Traverse(const Ray& localRay, float tMin, float& tMax, LeafFn&& leaf) const;
+	// Any hit of an object space ray, same layouts
+	template<typename LeafFn>
+	bool TraverseOccluded(const Ray& localRay, float tMin, float tMax, LeafFn&& leaf) const;
+
 	bool LoadFromOBJ(const std::string& filename);
 	void CalculateBoundingBox();
+	void BuildBVH(BVHBuildMode mode = BVHBuildMode::SAH);
+	// Turns m_BVH into the layout that is traversed, see BVHLayout
+	void BuildTraversalBVH();
+	// Triangles sharing each vertex, built on the first edit
+	void BuildVertexTriangles();
+
+	BVH m_BVH;
+	BVHBuildMode m_BVHBuildMode = BVHBuildMode::SAH;
+	BVHLayout m_BVHLayout = BVHLayout::Wide;
+	int m_BVHWidth = 2;
+	WideBVH<4> m_BVH4;
+	WideBVH<8> m_BVH8;
+	QuantizedBVH m_QuantizedBVH;
+	TriangleData m_TriangleData; // packed per BVH leaf
+	Bounds3f m_LocalBounds;
+	std::vector<uint32_t> m_VertexTriangleOffsets; // m_VertexTriangles[offsets[v], offsets[v + 1]) use vertex v
+	std::vector<uint32_t> m_VertexTriangles;
+	glm::vec3 m_Translation = glm::vec3(0.0f);
 };
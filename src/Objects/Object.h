@@ -2,12 +2,15 @@
 
 #include "RayTracer.h"
 #include "Ray.h"
+#include "Objects/BoundingBox.h"
+#include "Accel/RayPacket.h"
 
 struct HitPayload
 {
 	glm::vec3 WorldPosition;
 	glm::vec3 WorldNormal;
 	float HitDistance;
+	bool FrontFace; // the ray arrived on the side the surface normal points to, WorldNormal faces the ray either way
 
 	int ObjectIndex;
 };
@@ -20,6 +23,10 @@ struct Material
 
 	glm::vec3 EmissionColor = glm::vec3(0.0f);
 	float EmissionStrength = 0.0f;
+
+	// Of the part that is not metallic, how much is a clear dielectric rather than diffuse, see Bsdf
+	float Transmission = 0.0f;
+	float IOR = 1.5f;
 };
 
 enum class ObjectType
@@ -39,8 +46,39 @@ public:
 
 	virtual bool Hit(const Ray& r, float tMin, float tMax, float& hitDistance) const = 0;
 
+	// Whether anything of the object lies in (tMin, tMax) along r, for shadow rays. Objects that can stop at their
+	// first hit instead of looking for the closest one override this.
+	virtual bool Occluded(const Ray& r, float tMin, float tMax) const {
+		float hitDistance;
+		return Hit(r, tMin, tMax, hitDistance) && hitDistance > tMin && hitDistance < tMax;
+	}
+
+	// Closest hit of the rays in rayMask against their packet.TMax, which is lowered for the rays hit.
+	// Returns the mask of those rays. One ray at a time unless an object has something faster.
+	virtual uint64_t IntersectPacket(RayPacket& packet, float tMin, uint64_t rayMask) const {
+		uint64_t hits = 0;
+		for (; rayMask; rayMask &= rayMask - 1) {
+			int i = Utils::CountTrailingZeros64(rayMask);
+			float hitDistance;
+			if (Hit(packet.GetRay(i), tMin, packet.TMax[i], hitDistance) && hitDistance > tMin && hitDistance < packet.TMax[i]) {
+				packet.TMax[i] = hitDistance;
+				hits |= 1ull << i;
+			}
+		}
+		return hits;
+	}
+
 	virtual ObjectType GetType() const = 0;
 
+	// Unit surface normal where r, which hit the object at hitDistance, meets it. Either side of the surface.
+	virtual glm::vec3 GetNormal(const Ray& r, float hitDistance) const = 0;
+
+	// World space bounds, used to place the object in the scene's acceleration structure
+	virtual Bounds3f GetBounds() const = 0;
+
+	// Unbounded objects (planes) are kept out of the acceleration structure and always tested
+	virtual bool IsBounded() const { return true; }
+
 	glm::vec3 Origin;
 	int MaterialIndex = 0;
 };
@@ -11,6 +11,12 @@ public:
 	virtual bool Hit(const Ray& r, float tMin, float tMax, float& hitDistance) const override;
 
 	virtual ObjectType GetType() const override { return ObjectType::Plane; }
+
+	virtual glm::vec3 GetNormal(const Ray& r, float hitDistance) const override { return glm::normalize(m_Normal); }
+
+	virtual Bounds3f GetBounds() const override { return Bounds3f(); }
+
+	virtual bool IsBounded() const override { return false; }
 private:
 	glm::vec3 m_PointOnPlane;
 	glm::vec3 m_Normal;
@@ -43,6 +43,10 @@ public:
 
 	virtual ObjectType GetType() const override { return ObjectType::Sphere; }
 
+	virtual glm::vec3 GetNormal(const Ray& r, float hitDistance) const override { return glm::normalize(r.At(hitDistance) - Origin); }
+
+	virtual Bounds3f GetBounds() const override { return Bounds3f(Origin - glm::vec3(Radius), Origin + glm::vec3(Radius)); }
+
 public:
 	glm::vec3 Position;
 	float Radius;
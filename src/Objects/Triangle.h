@@ -3,6 +3,7 @@
 #include "RayTracer.h"
 
 #include "Object.h"
+#include <Accel/TriangleData.h>
 
 class Triangle : public Object {
 public:
@@ -16,5 +17,12 @@ public:
 
 	void MoveTo(const glm::vec3& newOrigin);
 
+	// Recomputes Normal and Origin after Vertices were edited in place
+	void Recalculate();
+
 	virtual ObjectType GetType() const override { return ObjectType::Triangle; }
+
+	virtual glm::vec3 GetNormal(const Ray& r, float hitDistance) const override { return Normal; }
+
+	virtual Bounds3f GetBounds() const override { return Union(Bounds3f(Vertices[0], Vertices[1]), Vertices[2]); }
 };
@@ -8,7 +8,6 @@
 #include <memory>
 #include <string>
 #include <vector>
-#include <random>
 
 #include "Timer.h"
 #include "glm/fwd.hpp"
@@ -60,41 +59,33 @@ static constexpr float Sqrt2 = 1.41421356237309504880f;
 // Utility Functions
 namespace Utils
 {
-	//// returns a float within [0, 1)
-	//inline float Randomfloat()
-	//{
-	//	return (float)std::random_device{}() / ((unsigned long long)std::numeric_limits<unsigned>::max() + 1);
-	//}
-
-	// using this pseudorandom generator for speeds sake
-	inline float Randomfloat()
+	// Same hash as pcg_hash in fragment.glsl (PCG RXS-M-XS), every random number on the CPU comes from it
+	inline uint32_t PcgHash(uint32_t seed)
 	{
-		// seed the engine using a guaranteed random uint32_t
-		// when multithreading use thread_local or else all cores will try to use one instance and will heavily impair speed
-		static thread_local std::default_random_engine eng(std::random_device{}());
-		static std::uniform_real_distribution<float> dis(0.0, 1.0);
-		return dis(eng);
+		uint32_t state = seed * 747796405u + 2891336453u;
+		uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
 	}
 
-	//// returns a float within [low, high)
-	//inline float Random(float low, float high)
-	//{
-	//	return low + ((float)std::random_device{}() / std::numeric_limits<unsigned>::max() + 1) * (high - low);
-	//}
+	// returns a float within [0, 1], advancing state like RandomFloat in fragment.glsl
+	inline float Randomfloat(uint32_t& state)
+	{
+		state = PcgHash(state);
+		return (float)state / 4294967295.0f;
+	}
 
-	// using this pseudorandom generator for speeds sake
-	inline float Random(float low, float high)
+	inline float Random(uint32_t& state, float low, float high)
 	{
-		// seed the engine using a guaranteed random uint32_t
-		// when multithreading use thread_local or else all cores will try to use one instance and will impair speed
-		static thread_local std::default_random_engine eng(std::random_device{}());
-		static std::uniform_real_distribution<float> dis(low, high);
-		return dis(eng);
+		return low + Randomfloat(state) * (high - low);
 	}
 
-	inline glm::vec3 RandomVector(float low, float high)
+	inline glm::vec3 RandomVector(uint32_t& state, float low, float high)
 	{
-		return glm::vec3(Random(low, high), Random(low, high), Random(low, high));
+		// separate statements so the components are drawn in a fixed order
+		float x = Random(state, low, high);
+		float y = Random(state, low, high);
+		float z = Random(state, low, high);
+		return glm::vec3(x, y, z);
 	}
 
 	inline uint32_t Vec3ToUInt32(const glm::vec3& v)
@@ -105,6 +96,42 @@ namespace Utils
 		return (0xff << 24) | (z << 16) | (y << 8) | x;
 	}
 
+	// Rec. 709 weights
+	inline float Luminance(const glm::vec3& color)
+	{
+		return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	// Tangent and bitangent completing a unit normal to a right handed basis (Duff et al. 2017)
+	inline void OrthonormalBasis(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent)
+	{
+		float sign = std::copysign(1.0f, n.z);
+		float a = -1.0f / (sign + n.z);
+		float b = n.x * n.y * a;
+		tangent = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+		bitangent = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+	}
+
+	// Direction in the hemisphere around a unit normal with density cos(theta) / Pi, from u in [0, 1)^2
+	inline glm::vec3 SampleCosineHemisphere(const glm::vec3& normal, const glm::vec2& u)
+	{
+		float r = std::sqrt(u.x);
+		float phi = 2.0f * Pi * u.y;
+		glm::vec3 tangent, bitangent;
+		OrthonormalBasis(normal, tangent, bitangent);
+		return glm::normalize(tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + normal * std::sqrt(std::max(0.0f, 1.0f - u.x)));
+	}
+
+	// Weights of a sample drawn with density pdf, when otherPdf could have drawn it too (Veach 1997)
+	inline float BalanceHeuristic(float pdf, float otherPdf)
+	{
+		return pdf / (pdf + otherPdf);
+	}
+	inline float PowerHeuristic(float pdf, float otherPdf)
+	{
+		return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+	}
+
 	template <typename T, typename U, typename V>
 	inline T Clamp(T val, U low, V high) {
 		if (val < low) return low;
@@ -150,7 +177,7 @@ namespace Utils
 	}
 #else
 	inline int Log2Int(uint32_t v) {
-		return 31 - __builtin_clzl(v);
+		return 31 - __builtin_clz(v);
 	}
 #endif
 
@@ -176,6 +203,60 @@ namespace Utils
 		return __builtin_ctzl(v);
 	}
 #endif
+
+	// Spreads the lower 10 bits of x out so there are two zero bits between each of them
+	inline uint32_t LeftShift3(uint32_t x)
+	{
+		if (x == (1 << 10)) --x;
+		x = (x | (x << 16)) & 0b00000011000000000000000011111111;
+		x = (x | (x << 8)) & 0b00000011000000001111000000001111;
+		x = (x | (x << 4)) & 0b00000011000011000011000011000011;
+		x = (x | (x << 2)) & 0b00001001001001001001001001001001;
+		return x;
+	}
+
+	// 30 bit Morton code of a point inside the unit cube
+	inline uint32_t EncodeMorton3(const glm::vec3& p)
+	{
+		constexpr float scale = 1 << 10;
+		return (LeftShift3((uint32_t)(p.z * scale)) << 2) | (LeftShift3((uint32_t)(p.y * scale)) << 1) | LeftShift3((uint32_t)(p.x * scale));
+	}
+
+	// Spreads the lower 16 bits of x out so there is a zero bit between each of them
+	inline uint32_t LeftShift2(uint32_t x)
+	{
+		x &= 0x0000ffff;
+		x = (x | (x << 8)) & 0x00ff00ff;
+		x = (x | (x << 4)) & 0x0f0f0f0f;
+		x = (x | (x << 2)) & 0x33333333;
+		x = (x | (x << 1)) & 0x55555555;
+		return x;
+	}
+
+	// Morton code of a 2D grid cell, x and y below 2^16
+	inline uint32_t EncodeMorton2(uint32_t x, uint32_t y)
+	{
+		return (LeftShift2(y) << 1) | LeftShift2(x);
+	}
+
+	// v must not be 0
+#ifdef _WIN32
+	inline int CountLeadingZeros64(uint64_t v) {
+		return (int)__lzcnt64(v);
+	}
+
+	inline int CountTrailingZeros64(uint64_t v) {
+		return (int)_tzcnt_u64(v);
+	}
+#else
+	inline int CountLeadingZeros64(uint64_t v) {
+		return __builtin_clzll(v);
+	}
+
+	inline int CountTrailingZeros64(uint64_t v) {
+		return __builtin_ctzll(v);
+	}
+#endif
 }
 
 #ifdef WIN32
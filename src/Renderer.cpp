@@ -8,70 +8,413 @@
 
 #include <execution>
 #include <algorithm>
+#include <chrono>
+#include <numeric>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
-void Renderer::Render(const Scene &scene, Camera &cam) {
-	if (m_Camera == nullptr || m_Scene == nullptr) {
-		m_Camera = &cam;
-		m_Scene = &scene;
-	}
-
+void Renderer::Render(const Scene &scene, const Camera &cam) {
 	if (m_RenderGPU) {
+		PauseRenderThread();
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Settings = m_PendingSettings;
+			if (m_PendingReset || m_PendingReprojection) {
+				m_FrameIndex = 1;
+				m_PendingReset = false;
+				m_PendingReprojection = false;
+			}
+		}
 		RenderGPU(scene, cam);
 		return;
 	}
 
-	if (m_RenderTexture->GetWidth() != m_Image->Width || m_RenderTexture->GetHeight() != m_Image->Height) {
-		printf("Resizing render texture to %d x %d\n", m_Image->Width, m_Image->Height);
-		delete m_RenderTexture;
-		m_RenderTexture = new Texture(m_Image->Width, m_Image->Height);
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_PendingScene = &scene;
+		m_PendingMaterials = scene.Materials;
+		if (m_CameraChanged) {
+			m_PendingCamera = cam;
+			m_PendingCameraFresh = true;
+			m_CameraChanged = false;
+		}
+		m_Paused = false;
 	}
+	if (!m_RenderThread.joinable())
+		m_RenderThread = std::thread(&Renderer::RenderThreadLoop, this);
+	m_RenderWake.notify_one();
 
-	if (m_FrameIndex == 1) {
-		memset(m_AccumulationData, 0, m_Image->Width * m_Image->Height * sizeof(glm::vec3));
+	PresentFrame();
+}
+
+void Renderer::ResetFrameIndex() {
+	{
+		// the render thread waits for the new camera instead of starting another frame with the old one
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Paused = true;
+		m_Converged = false;
+		m_PendingReset = true;
+		m_CameraChanged = true;
+	}
+	m_Cancel = true;
+}
+
+void Renderer::MoveCamera() {
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Paused = true;
+		m_Converged = false;
+		m_PendingReprojection = true;
+		m_CameraChanged = true;
+	}
+	m_Cancel = true;
+}
+
+void Renderer::CancelRender() {
+	PauseRenderThread();
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Converged = false;
+	m_PendingReset = true;
+}
+
+void Renderer::RenderPasses(const Scene& scene, const Camera& cam, uint32_t passes) {
+	PauseRenderThread();
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Settings = m_PendingSettings;
+		if (m_PendingReset || m_PendingReprojection) {
+			m_FrameIndex = 1;
+			m_ClearAccumulation = true;
+			m_PendingReset = false;
+			m_PendingReprojection = false;
+		}
+	}
+	m_Settings.FrameBudget = 0.0f;
+	m_Settings.AdaptiveSampling = false;
+	m_Scene = &scene;
+	m_Materials = scene.Materials;
+	m_Camera = cam;
+	m_CameraChanged = true; // the interactive render picks up its own camera again
+	m_Cancel = false;
+
+	for (uint32_t i = 0; i < passes; i++)
+		RenderFrame();
+}
+
+std::vector<glm::vec3> Renderer::GetAccumulation() const {
+	std::vector<glm::vec3> accumulation((size_t)m_Image->Width * m_Image->Height);
+	for (size_t i = 0; i < accumulation.size(); i++) {
+		const glm::vec4& accumulated = m_AccumulationData[i];
+		accumulation[i] = accumulated.w > 0.0f ? glm::vec3(accumulated) / accumulated.w : glm::vec3(0.0f);
+	}
+	return accumulation;
+}
+
+void Renderer::PauseRenderThread() {
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_Paused = true;
+	m_Cancel = true;
+	m_RenderIdle.wait(lock, [this] { return !m_Rendering; });
+}
+
+void Renderer::StopRenderThread() {
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_StopThread = true;
+		m_Cancel = true;
+	}
+	m_RenderWake.notify_one();
+	if (m_RenderThread.joinable())
+		m_RenderThread.join();
+}
+
+void Renderer::RenderThreadLoop() {
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_RenderWake.wait(lock, [this] { return m_StopThread || (!m_Paused && !m_Converged); });
+			if (m_StopThread)
+				return;
+
+			m_Cancel = false;
+			m_Rendering = true;
+			// tiles that converged under a looser threshold have more to do, every one is tested again
+			if (m_PendingSettings.AdaptiveThreshold < m_Settings.AdaptiveThreshold
+					|| m_PendingSettings.AdaptiveMinSamples > m_Settings.AdaptiveMinSamples) {
+				m_TileConverged.assign(m_Tiles.size(), 0);
+				m_PassTiles.clear();
+				m_PassCompleted = false;
+			}
+			m_Settings = m_PendingSettings;
+			m_Scene = m_PendingScene;
+			m_Materials = m_PendingMaterials;
+			if (m_PendingCameraFresh) {
+				m_Camera = m_PendingCamera;
+				m_PendingCameraFresh = false;
+			}
+			if (m_PendingReset) {
+				m_FrameIndex = 1;
+				m_ClearAccumulation = true;
+				m_PendingReset = false;
+			} else if (m_PendingReprojection) {
+				m_FrameIndex = 1;
+				m_ReprojectAccumulation = true;
+			}
+			m_PendingReprojection = false;
+		}
+
+		if (RenderFrame()) {
+			// publish the back buffer, the UI picks it up on its next Render
+			m_BackBuffer = m_ReadyBuffer.exchange(m_BackBuffer | FreshFrame) & ~FreshFrame;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Rendering = false;
+		}
+		m_RenderIdle.notify_all();
+	}
+}
+
+bool Renderer::RenderFrame() {
+	if (m_TopLevelBVH.Update(m_Scene->Objects))
+		m_LightsValid = false;
+
+	unsigned int threadCount = m_Settings.ThreadCount > 0 ? m_Settings.ThreadCount : std::max(std::thread::hardware_concurrency(), 1u);
+	if (!m_ThreadPool || m_ThreadPool->GetThreadCount() != threadCount)
+		m_ThreadPool = std::make_unique<ThreadPool>(threadCount);
+	if (m_TileSize != m_Settings.TileSize)
+		UpdateTiles();
+	if (!m_Sampler || m_SamplerType != m_Settings.Sampling || m_SamplerSeed != m_Settings.SamplerSeed) {
+		m_Sampler = Sampler::Create(m_Settings.Sampling, m_Image->Width, m_Settings.SamplerSeed);
+		m_SamplerType = m_Settings.Sampling;
+		m_SamplerSeed = m_Settings.SamplerSeed;
+	}
+
+	if (m_ReprojectAccumulation) {
+		// a clear already pending wins, and the old camera's G-buffer is needed to know where its samples went
+		if (!m_ClearAccumulation && m_GBufferValid && m_Settings.TemporalReuse && m_Settings.Accumulate)
+			ReprojectAccumulation();
+		else
+			m_ClearAccumulation = true;
+		m_ReprojectAccumulation = false;
+	}
+	if (m_ClearAccumulation) {
+		memset(m_AccumulationData, 0, m_Image->Width * m_Image->Height * sizeof(glm::vec4));
+		std::fill(m_LuminanceSquares.begin(), m_LuminanceSquares.end(), 0.0f);
+		m_TileConverged.assign(m_Tiles.size(), 0);
+		m_PassTiles.clear();
+		m_ClearAccumulation = false;
+		m_GBufferValid = false;
+		m_PassCompleted = false;
+		// edits to the geometry and materials restart accumulation
+		m_LightsValid = false;
+	}
+	if (!m_LightsValid) {
+		m_Lights.Build(*m_Scene, m_Materials);
+		m_LightsValid = true;
+	}
+	// the next camera move reprojects through it
+	if (m_Settings.TemporalReuse && m_Settings.Accumulate && !m_GBufferValid)
+		RenderGBuffer();
+
+	UpdateActiveTiles();
+	if (m_ActiveTiles.empty()) {
+		// nothing left to trace, sleep until the camera, scene or settings change
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Converged = true;
+		m_ConvergedFraction = 1.0f;
+		return false;
+	}
+
+	std::chrono::time_point <std::chrono::high_resolution_clock> start, end;
+	start = std::chrono::high_resolution_clock::now();
+	m_PathSegments = 0;
+	uint64_t tracedPixels = 0;
+	for (uint32_t tile : m_ActiveTiles) {
+		uint32_t x0, y0, x1, y1;
+		GetTileRect(tile, x0, y0, x1, y1);
+		tracedPixels += (x1 - x0) * (y1 - y0);
 	}
 
 #define MT 1
 #if MT
-	// A good bit faster than using my previous 8 thread method
-	// This (sometimes) doesn't work on linux apparently
-	// something something libtbb
-	std::for_each(std::execution::par_unseq, m_ImageVerticalIter.begin(), m_ImageVerticalIter.end(), [this](uint32_t y) {
-			std::for_each(std::execution::par_unseq, m_ImageHorizontalIter.begin(), m_ImageHorizontalIter.end(),
-					[this, y](uint32_t x) {
-					auto color = PerPixel({ (float)x, (float)y });
-					m_AccumulationData[x + y * this->m_Image->Width] += color;
-					auto accumulated_color = m_AccumulationData[x + y * this->m_Image->Width];
-					accumulated_color /= (float)m_FrameIndex;
-					accumulated_color = glm::clamp(accumulated_color, glm::vec3(0.0f), glm::vec3(1.0f));
-					m_Image->Data[x + y * this->m_Image->Width] = Utils::Vec3ToUInt32(accumulated_color);
-					});
-			});
+	if (m_Settings.Wavefront) {
+		RenderWavefront();
+		if (!m_Cancel)
+			CompletePass();
+	} else if (m_Settings.FrameBudget > 0.0f) {
+		tracedPixels = RenderBudgeted(start);
+	} else {
+		m_ThreadPool->Run(m_ActiveTiles, [this](uint32_t tile) {
+				if (!m_Cancel)
+					RenderTile(tile);
+				});
+		if (!m_Cancel)
+			CompletePass();
+	}
 
 #else // MT
 
 	for (int y = 0; y < (int)m_Image->Height; y++) {
 		for (int x = 0; x < (int)m_Image->Width; x++) {
-			auto color = PerPixel({ (float)x, (float)y });
-			m_AccumulationData[x + y * this->m_Image->Width] += color;
-			auto accumulated_color = m_AccumulationData[x + y * this->m_Image->Width];
-			accumulated_color /= (float)m_FrameIndex;
-			accumulated_color = glm::clamp(accumulated_color, glm::vec3(0.0f), glm::vec3(1.0f));
-			m_Image->Data[x + y * this->m_Image->Width] = Utils::VectorToUInt32(accumulated_color);
+			AccumulatePixel(x, y, PerPixel({ (float)x, (float)y }));
 		}
 	}
+	CompletePass();
 
 #endif // MT
-        m_RenderTexture->SetData((unsigned char*)m_Image->Data);
 
+	if (m_Cancel)
+		return false;
+
+	end = std::chrono::high_resolution_clock::now();
+	int64_t duration = std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count(), 1);
+
+	// overwrites the resolved pixels in the back buffer
+	double denoiseTime = 0.0;
+	if (m_Settings.Denoise && m_PassCompleted) {
+		if (!m_GBufferValid)
+			RenderGBuffer();
+		start = std::chrono::high_resolution_clock::now();
+		m_Denoiser.Filter(*m_ThreadPool, m_AccumulationData, m_LuminanceSquares.data(), m_Settings.DenoiseIterations,
+				m_FrameBuffers[m_BackBuffer].data());
+		end = std::chrono::high_resolution_clock::now();
+		denoiseTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+	}
+	if (m_Cancel)
+		return false;
+
+	uint64_t convergedPixels = 0;
+	for (uint32_t tile = 0; tile < (uint32_t)m_Tiles.size(); tile++) {
+		if (!m_TileConverged[tile])
+			continue;
+		uint32_t x0, y0, x1, y1;
+		GetTileRect(tile, x0, y0, x1, y1);
+		convergedPixels += (x1 - x0) * (y1 - y0);
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_SamplesPerSecond = (double)tracedPixels * m_Settings.NumberOfSamples / duration * 1e6;
+	m_AveragePathLength = (double)m_PathSegments / std::max<uint64_t>(tracedPixels * m_Settings.NumberOfSamples, 1);
+	m_ThreadUtilization = m_ThreadPool->GetUtilization();
+	m_DenoiseTime = denoiseTime;
+	m_ConvergedFraction = (float)convergedPixels / (m_Image->Width * m_Image->Height);
+	return true;
+}
+
+uint64_t Renderer::RenderBudgeted(std::chrono::high_resolution_clock::time_point start) {
+	auto deadline = start + std::chrono::microseconds((long)(m_Settings.FrameBudget * 1000.0f));
+	std::atomic<uint64_t> tracedPixels = 0;
+	m_TileTraced.assign(m_Tiles.size(), 0);
+
+	// Tiles are skipped once the deadline has passed, except for the first one per thread of the frame, so passes
+	// still complete when the budget is below the cost of a tile. Several passes fit into one frame when the image
+	// is cheap.
+	const uint32_t guaranteedTiles = m_ThreadPool->GetThreadCount();
+	std::atomic<uint32_t> startedTiles = 0;
+	do {
+		if (m_PassTiles.empty()) {
+			UpdateActiveTiles();
+			if (m_ActiveTiles.empty())
+				break;
+			m_PassTiles = m_ActiveTiles;
+		}
+
+		m_ThreadPool->Run(m_PassTiles, [&](uint32_t tile) {
+				if (m_Cancel || (startedTiles++ >= guaranteedTiles && std::chrono::high_resolution_clock::now() >= deadline))
+					return;
+				RenderTile(tile);
+				m_TileTraced[tile] = 1;
+				uint32_t x0, y0, x1, y1;
+				GetTileRect(tile, x0, y0, x1, y1);
+				tracedPixels += (x1 - x0) * (y1 - y0);
+				});
+		if (m_Cancel)
+			break;
+
+		m_PassTiles.erase(std::remove_if(m_PassTiles.begin(), m_PassTiles.end(), [this](uint32_t tile) { return m_TileTraced[tile]; }),
+				m_PassTiles.end());
+		if (m_PassTiles.empty()) {
+			CompletePass();
+			m_TileTraced.assign(m_Tiles.size(), 0);
+		}
+	} while (std::chrono::high_resolution_clock::now() < deadline);
+
+	// the back buffer held an older frame, bring every tile up to date and not just the ones traced
+	m_ThreadPool->Run(m_Tiles, [this](uint32_t tile) {
+			uint32_t x0, y0, x1, y1;
+			GetTileRect(tile, x0, y0, x1, y1);
+			for (uint32_t y = y0; y < y1; y++) {
+				for (uint32_t x = x0; x < x1; x++)
+					ResolvePixel(x, y);
+			}
+			});
+	return tracedPixels;
+}
+
+void Renderer::CompletePass() {
+	m_PassCompleted = true;
+	m_PassIndex++;
 	if (m_Settings.Accumulate)
 		m_FrameIndex++;
 	else
 		m_FrameIndex = 1;
 }
 
+void Renderer::UpdateActiveTiles() {
+	if (!m_Settings.AdaptiveSampling || !m_Settings.Accumulate || m_Settings.Wavefront) {
+		m_ActiveTiles = m_Tiles;
+		return;
+	}
+
+	m_ActiveTiles.clear();
+	for (uint32_t tile : m_Tiles) {
+		if (!m_TileConverged[tile])
+			m_ActiveTiles.push_back(tile);
+	}
+}
+
+bool Renderer::IsTileConverged(uint32_t tile) const {
+	uint32_t x0, y0, x1, y1;
+	GetTileRect(tile, x0, y0, x1, y1);
+	for (uint32_t y = y0; y < y1; y++) {
+		for (uint32_t x = x0; x < x1; x++) {
+			const glm::vec4& accumulated = m_AccumulationData[x + y * m_Image->Width];
+			float n = accumulated.w;
+			if (n < (float)std::max(m_Settings.AdaptiveMinSamples, 2u))
+				return false;
+
+			float mean = Utils::Luminance(glm::vec3(accumulated)) / n;
+			float variance = std::max(m_LuminanceSquares[x + y * m_Image->Width] / n - mean * mean, 0.0f) * n / (n - 1.0f);
+			// standard error of the mean over the square root of the mean, noise is easier to see in dark regions
+			// but a plain relative error would never let nearly black pixels converge
+			float error = std::sqrt(variance / n / std::max(mean, 1e-4f));
+			if (error > m_Settings.AdaptiveThreshold)
+				return false;
+		}
+	}
+	return true;
+}
+
+void Renderer::PresentFrame() {
+	if (m_RenderTexture->GetWidth() != (int)m_Image->Width || m_RenderTexture->GetHeight() != (int)m_Image->Height) {
+		printf("Resizing render texture to %d x %d\n", m_Image->Width, m_Image->Height);
+		delete m_RenderTexture;
+		m_RenderTexture = new Texture(m_Image->Width, m_Image->Height);
+	}
+
+	if (!(m_ReadyBuffer.load() & FreshFrame))
+		return;
+
+	m_FrontBuffer = m_ReadyBuffer.exchange(m_FrontBuffer) & ~FreshFrame;
+	// keep the image in sync with what is shown, it is written to disk on exit
+	const std::vector<uint32_t>& frame = m_FrameBuffers[m_FrontBuffer];
+	memcpy(m_Image->Data, frame.data(), frame.size() * sizeof(uint32_t));
+	m_RenderTexture->SetData((unsigned char*)m_Image->Data);
+}
+
 void Renderer::RenderGPU(const Scene& scene, const Camera& cam) {
 	if (!m_GPUSetup) {
 		SetupGPUBuffers(scene);
@@ -98,6 +441,9 @@ void Renderer::RenderGPU(const Scene& scene, const Camera& cam) {
 	m_Shader.SetUniform1i("MeshCount", m_MeshSize);
 	m_Shader.SetUniform1i("FrameIndex", m_FrameIndex);
 	m_Shader.SetUniform1i("Accumulate", m_Settings.Accumulate ? 1 : 0);
+	m_Shader.SetUniform1i("NextEventEstimation", m_Settings.NextEventEstimation ? 1 : 0);
+	m_Shader.SetUniform1i("LightWeighting", (int)m_Settings.LightWeighting);
+	m_Shader.SetUniform1i("RussianRouletteDepth", m_Settings.RussianRouletteDepth);
 
 	// Clear accumulation texture on first frame
 	if (m_FrameIndex == 1) {
@@ -118,7 +464,9 @@ void Renderer::RenderGPU(const Scene& scene, const Camera& cam) {
 				.Roughness = material.Roughness,
 				.EmissionColor = material.EmissionColor,
 				.EmissionStrength = material.EmissionStrength,
-				.Metallic = material.Metallic
+				.Metallic = material.Metallic,
+				.Transmission = material.Transmission,
+				.IOR = material.IOR
 				});
 	}
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_MaterialSSBO);
@@ -127,6 +475,10 @@ void Renderer::RenderGPU(const Scene& scene, const Camera& cam) {
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_TriangleSSBO);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_MeshSSBO);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_MaterialSSBO);
+	UpdateGPULights(scene);
+	m_Shader.SetUniform1i("LightCount", m_LightCount);
+	m_Shader.SetUniform1f("LightTotalPower", m_LightTotalPower);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_LightSSBO);
 	glBindVertexArray(m_QuadVAO);
 	glDrawArrays(GL_TRIANGLES, 0, 6);
 	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
@@ -143,77 +495,455 @@ void Renderer::RenderGPU(const Scene& scene, const Camera& cam) {
 }
 
 void Renderer::SetImage(Image &image) {
+	CancelRender();
+
 	m_Image = &image;
 	delete[] m_AccumulationData;
-	m_AccumulationData = new glm::vec3[m_Image->Width * m_Image->Height];
+	m_AccumulationData = new glm::vec4[m_Image->Width * m_Image->Height];
+	m_LuminanceSquares.assign((size_t)m_Image->Width * m_Image->Height, 0.0f);
+	for (auto& frame : m_FrameBuffers)
+		frame.assign((size_t)m_Image->Width * m_Image->Height, 0);
+	// a frame of the old size is never shown
+	m_ReadyBuffer = m_ReadyBuffer & ~FreshFrame;
 
 	m_ImageVerticalIter.resize(m_Image->Height);
-	m_ImageHorizontalIter.resize(m_Image->Width);
+	m_Sampler.reset(); // the blue noise sampler maps pixel indices with the image width
+	m_Denoiser.Resize(m_Image->Width, m_Image->Height);
+	m_GBufferValid = false;
 
 	for (uint32_t x = 0; x < m_Image->Height; x++)
 		m_ImageVerticalIter[x] = x;
 
-	for (uint32_t y = 0; y < m_Image->Width; y++)
-		m_ImageHorizontalIter[y] = y;
+	UpdateTiles();
+}
+
+void Renderer::UpdateTiles() {
+	m_TileSize = std::max(m_Settings.TileSize, 1u);
+	m_PassTiles.clear();
+	// tiles of another size need their convergence tested again
+	m_TileConverged.clear();
+	uint32_t tilesX = (m_Image->Width + m_TileSize - 1) / m_TileSize;
+	uint32_t tilesY = (m_Image->Height + m_TileSize - 1) / m_TileSize;
+
+	m_Tiles.resize(tilesX * tilesY);
+	m_TileConverged.resize(m_Tiles.size(), 0);
+	std::iota(m_Tiles.begin(), m_Tiles.end(), 0);
+	std::sort(m_Tiles.begin(), m_Tiles.end(), [tilesX](uint32_t a, uint32_t b) {
+			return Utils::EncodeMorton2(a % tilesX, a / tilesX) < Utils::EncodeMorton2(b % tilesX, b / tilesX);
+			});
+}
+
+void Renderer::RenderTile(uint32_t tile) {
+	TracePrimaryRays(tile, [this](uint32_t x, uint32_t y, const Ray& r, const HitPayload& payload) {
+			AccumulatePixel(x, y, TracePath(r, payload, x + y * m_Image->Width));
+			});
+	if (m_Settings.AdaptiveSampling && m_Settings.Accumulate && IsTileConverged(tile))
+		m_TileConverged[tile] = 1;
+}
+
+void Renderer::GetTileRect(uint32_t tile, uint32_t& x0, uint32_t& y0, uint32_t& x1, uint32_t& y1) const {
+	uint32_t tilesX = (m_Image->Width + m_TileSize - 1) / m_TileSize;
+	x0 = (tile % tilesX) * m_TileSize;
+	y0 = (tile / tilesX) * m_TileSize;
+	x1 = std::min(x0 + m_TileSize, m_Image->Width);
+	y1 = std::min(y0 + m_TileSize, m_Image->Height);
+}
+
+template<typename PixelFn>
+void Renderer::TracePrimaryRays(uint32_t tile, PixelFn&& pixel, bool jitter) {
+	uint32_t tileX0, tileY0, tileX1, tileY1;
+	GetTileRect(tile, tileX0, tileY0, tileX1, tileY1);
+	auto direction = [&](uint32_t x, uint32_t y) {
+		return jitter ? PrimaryRayDirection(x, y) : m_Camera.CalculateRayDirection({ x + 0.5f, y + 0.5f });
+	};
+
+	if (!m_Settings.PacketTracing) {
+		for (uint32_t y = tileY0; y < tileY1; y++) {
+			for (uint32_t x = tileX0; x < tileX1; x++) {
+				Ray r = Ray(m_Camera.GetPosition(), direction(x, y));
+				pixel(x, y, r, TraceRay(r));
+			}
+		}
+		return;
+	}
+
+	for (uint32_t y0 = tileY0; y0 < tileY1; y0 += RayPacket::TileSize) {
+		for (uint32_t x0 = tileX0; x0 < tileX1; x0 += RayPacket::TileSize) {
+			uint32_t x1 = std::min(x0 + RayPacket::TileSize, tileX1), y1 = std::min(y0 + RayPacket::TileSize, tileY1);
+
+			RayPacket packet;
+			packet.Origin = m_Camera.GetPosition();
+			for (uint32_t y = y0; y < y1; y++) {
+				for (uint32_t x = x0; x < x1; x++)
+					packet.Directions[packet.Size++] = direction(x, y);
+			}
+			packet.Setup();
+			m_TopLevelBVH.IntersectPacket(packet, 0);
+
+			int i = 0;
+			for (uint32_t y = y0; y < y1; y++) {
+				for (uint32_t x = x0; x < x1; x++, i++) {
+					Ray r = packet.GetRay(i);
+					HitPayload payload = packet.ObjectIndex[i] < 0 ? Miss(r) : ClosestHit(r, packet.TMax[i], packet.ObjectIndex[i]);
+					pixel(x, y, r, payload);
+				}
+			}
+		}
+	}
+}
+
+void Renderer::RenderGBuffer() {
+	// not cancelled, it is one ray per pixel and a reprojection cannot go on without it
+	m_GBuffer.NormalDepth.resize((size_t)m_Image->Width * m_Image->Height);
+	m_GBuffer.ViewProjection = m_Camera.GetViewProjection();
+	m_GBuffer.Origin = m_Camera.GetPosition();
+	m_ThreadPool->Run(m_Tiles, [this](uint32_t tile) {
+			TracePrimaryRays(tile, [this](uint32_t x, uint32_t y, const Ray&, const HitPayload& payload) {
+					uint32_t pixel = x + y * m_Image->Width;
+					if (payload.HitDistance < 0) {
+						m_GBuffer.NormalDepth[pixel] = glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+						m_Denoiser.ClearFeatures(pixel);
+						return;
+					}
+					m_GBuffer.NormalDepth[pixel] = glm::vec4(payload.WorldNormal, payload.HitDistance);
+					const Material& material = m_Materials[m_Scene->Objects[payload.ObjectIndex]->MaterialIndex];
+					m_Denoiser.SetFeatures(pixel, material.Albedo, payload.WorldNormal, payload.HitDistance);
+					}, false);
+			});
+	m_Denoiser.CommitFeatures(*m_ThreadPool);
+	m_GBufferValid = true;
+}
+
+void Renderer::ReprojectAccumulation() {
+	std::swap(m_GBuffer, m_PreviousGBuffer);
+	RenderGBuffer();
+
+	const size_t pixelCount = (size_t)m_Image->Width * m_Image->Height;
+	m_AccumulationHistory.assign(m_AccumulationData, m_AccumulationData + pixelCount);
+	std::swap(m_LuminanceSquares, m_LuminanceSquaresHistory);
+	m_LuminanceSquares.resize(pixelCount);
+	m_ThreadPool->Run(m_Tiles, [this](uint32_t tile) {
+			uint32_t x0, y0, x1, y1;
+			GetTileRect(tile, x0, y0, x1, y1);
+			for (uint32_t y = y0; y < y1; y++) {
+				for (uint32_t x = x0; x < x1; x++)
+					ReprojectPixel(x, y);
+			}
+			});
+
+	// the reprojected pixels may not have enough samples anymore, and some have none
+	m_TileConverged.assign(m_Tiles.size(), 0);
+	m_PassTiles.clear();
+	m_PassCompleted = false;
+}
+
+void Renderer::ReprojectPixel(uint32_t x, uint32_t y) {
+	// A history pixel is kept when the distance from the old camera to the surface seen now is within a fraction
+	// of what it saw, and the normals agree to within about 25 degrees
+	constexpr float DepthTolerance = 0.03f;
+	constexpr float NormalTolerance = 0.9f;
+
+	const uint32_t pixel = x + y * m_Image->Width;
+	m_AccumulationData[pixel] = glm::vec4(0.0f);
+	m_LuminanceSquares[pixel] = 0.0f;
+
+	// where the surface is, misses are reprojected by their direction alone
+	const glm::vec4& surface = m_GBuffer.NormalDepth[pixel];
+	const glm::vec3 direction = m_Camera.CalculateRayDirection({ x + 0.5f, y + 0.5f });
+	const glm::vec3 position = m_GBuffer.Origin + direction * surface.w;
+	const bool miss = surface.w < 0.0f;
+	const float distance = glm::length(position - m_PreviousGBuffer.Origin);
+
+	glm::vec4 clip = m_PreviousGBuffer.ViewProjection * (miss ? glm::vec4(direction, 0.0f) : glm::vec4(position, 1.0f));
+	if (clip.w <= 0.0f)
+		return;
+	// pixel coordinates in the old image, with the pixel centres on integers
+	const glm::vec2 previous = (glm::vec2(clip.x, clip.y) / clip.w * 0.5f + 0.5f) * glm::vec2(m_Image->Width, m_Image->Height) - 0.5f;
+	const glm::vec2 base = glm::floor(previous);
+	const glm::vec2 fraction = previous - base;
+
+	// bilinear over the 2x2 old pixels around it that saw the same surface
+	glm::vec3 mean(0.0f);
+	float luminanceSquares = 0.0f, samples = 0.0f, weights = 0.0f;
+	for (int j = 0; j < 2; j++) {
+		int64_t yy = (int64_t)base.y + j;
+		if (yy < 0 || yy >= m_Image->Height)
+			continue;
+		for (int i = 0; i < 2; i++) {
+			int64_t xx = (int64_t)base.x + i;
+			if (xx < 0 || xx >= m_Image->Width)
+				continue;
+			const size_t q = xx + yy * m_Image->Width;
+			const glm::vec4& history = m_AccumulationHistory[q];
+			const glm::vec4& old = m_PreviousGBuffer.NormalDepth[q];
+			if (history.w == 0.0f || (old.w < 0.0f) != miss)
+				continue;
+			if (!miss && (std::abs(old.w - distance) > DepthTolerance * distance || glm::dot(glm::vec3(old), glm::vec3(surface)) < NormalTolerance))
+				continue;
+
+			float w = (i ? fraction.x : 1.0f - fraction.x) * (j ? fraction.y : 1.0f - fraction.y);
+			mean += w * glm::vec3(history) / history.w;
+			luminanceSquares += w * m_LuminanceSquaresHistory[q] / history.w;
+			samples += w * history.w;
+			weights += w;
+		}
+	}
+	// disoccluded, or only a sliver of a tap agreed
+	if (weights < 0.05f)
+		return;
+
+	// Whole passes, the count also numbers the pixel's next sample. Fewer of them weigh the new samples more, which
+	// clamps how long a history lasts.
+	samples = std::min(std::floor(samples / weights), (float)m_Settings.TemporalHistory);
+	if (samples < 1.0f)
+		return;
+	m_AccumulationData[pixel] = glm::vec4(mean / weights * samples, samples);
+	m_LuminanceSquares[pixel] = luminanceSquares / weights * samples;
+}
+
+void Renderer::RenderWavefront() {
+	const uint32_t pixelCount = m_Image->Width * m_Image->Height;
+	m_PrimaryRays.resize(pixelCount);
+	m_PrimaryHits.resize(pixelCount);
+	m_PixelRadiance.assign(pixelCount, glm::vec3(0.0f));
+	m_Paths.resize(pixelCount);
+	m_SortedPaths.resize(pixelCount);
+	m_RayKeys.resize(pixelCount);
+	m_PathHits.resize(pixelCount);
+
+	// the primary hits are the same for every sample
+	auto primary = [this](uint32_t x, uint32_t y, const Ray& r, const HitPayload& payload) {
+		m_PrimaryRays[x + y * m_Image->Width] = r;
+		m_PrimaryHits[x + y * m_Image->Width] = payload;
+	};
+	m_ThreadPool->Run(m_Tiles, [&](uint32_t tile) {
+			if (!m_Cancel)
+				TracePrimaryRays(tile, primary);
+			});
+
+	const Bounds3f sceneBounds = m_TopLevelBVH.GetBounds();
+	for (int sample = 0; sample < m_Settings.NumberOfSamples && !m_Cancel; sample++) {
+		std::for_each(std::execution::par_unseq, m_PrimaryRays.begin(), m_PrimaryRays.end(), [&](const Ray& r) {
+				uint32_t pixel = (uint32_t)(&r - m_PrimaryRays.data());
+				m_Paths[pixel] = { { r }, pixel, true };
+				});
+
+		// active paths are kept at the front of m_Paths
+		size_t activeCount = pixelCount;
+		for (int bounce = 0; bounce < m_Settings.NumberOfBounces + 1 && activeCount > 0; bounce++) {
+			m_PathSegments += activeCount;
+			auto first = m_Paths.begin(), last = m_Paths.begin() + activeCount;
+			if (bounce > 0) {
+				// Sort the stream by direction octant, then by the Morton cell of the origin, so rays traced one
+				// after another walk the same part of the hierarchy. 3 + 29 key bits above the path index.
+				std::for_each(std::execution::par_unseq, first, last, [&](const WavefrontPath& path) {
+						size_t i = &path - m_Paths.data();
+						const glm::vec3& d = path.State.CurrentRay.Direction;
+						uint32_t octant = (d.x < 0.0f ? 4 : 0) | (d.y < 0.0f ? 2 : 0) | (d.z < 0.0f ? 1 : 0);
+						glm::vec3 cell = glm::clamp(sceneBounds.Offset(path.State.CurrentRay.Origin), glm::vec3(0.0f), glm::vec3(1.0f));
+						m_RayKeys[i] = ((uint64_t)(octant << 29 | Utils::EncodeMorton3(cell) >> 1) << 32) | i;
+						});
+				std::sort(std::execution::par_unseq, m_RayKeys.begin(), m_RayKeys.begin() + activeCount);
+				std::for_each(std::execution::par_unseq, m_RayKeys.begin(), m_RayKeys.begin() + activeCount, [&](const uint64_t& key) {
+						m_SortedPaths[&key - m_RayKeys.data()] = m_Paths[(uint32_t)key];
+						});
+				std::swap(m_Paths, m_SortedPaths);
+				first = m_Paths.begin();
+				last = m_Paths.begin() + activeCount;
+
+				// trace pass, consecutive rays of the sorted stream go to the same thread
+				std::for_each(std::execution::par_unseq, first, last, [&](const WavefrontPath& path) {
+						m_PathHits[&path - m_Paths.data()] = TraceRay(path.State.CurrentRay);
+						});
+			}
+
+			// shade pass, a path ends by adding its radiance to its pixel (one path per pixel, so no races)
+			std::for_each(std::execution::par_unseq, first, last, [&](WavefrontPath& path) {
+					const HitPayload& payload = bounce == 0 ? m_PrimaryHits[path.Pixel] : m_PathHits[&path - m_Paths.data()];
+					if (payload.HitDistance < 0 || !Shade(payload, bounce, BounceSamples(path.Pixel, sample, bounce), path.State)) {
+						m_PixelRadiance[path.Pixel] += path.State.Radiance;
+						path.Active = false;
+					}
+					});
+
+			activeCount = std::partition(first, last, [](const WavefrontPath& path) { return path.Active; }) - first;
+		}
+
+		// paths still going after the last bounce
+		std::for_each(std::execution::par_unseq, m_Paths.begin(), m_Paths.begin() + activeCount, [&](const WavefrontPath& path) {
+				m_PixelRadiance[path.Pixel] += path.State.Radiance;
+				});
+	}
+
+	if (m_Cancel)
+		return;
+
+	std::for_each(std::execution::par_unseq, m_ImageVerticalIter.begin(), m_ImageVerticalIter.end(), [&](uint32_t y) {
+			for (uint32_t x = 0; x < m_Image->Width; x++) {
+				glm::vec3 color = m_PixelRadiance[x + y * m_Image->Width] / (float)m_Settings.NumberOfSamples;
+				AccumulatePixel(x, y, glm::clamp(color, glm::vec3(0.0f), glm::vec3(1.0f)));
+			}
+			});
+}
+
+void Renderer::AccumulatePixel(uint32_t x, uint32_t y, const glm::vec3& color) {
+	glm::vec4& accumulated = m_AccumulationData[x + y * m_Image->Width];
+	float& luminanceSquares = m_LuminanceSquares[x + y * m_Image->Width];
+	float luminance = Utils::Luminance(color);
+	// without accumulation only the newest sample is kept
+	if (m_Settings.Accumulate) {
+		accumulated += glm::vec4(color, 1.0f);
+		luminanceSquares += luminance * luminance;
+	} else {
+		accumulated = glm::vec4(color, 1.0f);
+		luminanceSquares = luminance * luminance;
+	}
+	ResolvePixel(x, y);
+}
+
+void Renderer::ResolvePixel(uint32_t x, uint32_t y) {
+	const glm::vec4& accumulated = m_AccumulationData[x + y * m_Image->Width];
+	glm::vec3 accumulated_color = accumulated.w > 0.0f ? glm::vec3(accumulated) / accumulated.w : glm::vec3(0.0f);
+	accumulated_color = glm::clamp(accumulated_color, glm::vec3(0.0f), glm::vec3(1.0f));
+	m_FrameBuffers[m_BackBuffer][x + y * m_Image->Width] = Utils::Vec3ToUInt32(accumulated_color);
 }
 
 glm::vec3 Renderer::PerPixel(const glm::vec2 &&coord) {
-	glm::vec3 res = glm::vec3(0.0f);
+	Ray r = Ray(m_Camera.GetPosition(), PrimaryRayDirection((uint32_t)coord.x, (uint32_t)coord.y));
+	return TracePath(r, TraceRay(r), (uint32_t)coord.x + (uint32_t)coord.y * m_Image->Width);
+}
 
-	for (int i = 0; i < m_Settings.NumberOfSamples; i++) {
-		glm::vec3 bounce_res = glm::vec3(0.0f);
-		glm::vec3 ray_color = glm::vec3(1.0f);
+glm::vec3 Renderer::PrimaryRayDirection(uint32_t x, uint32_t y) {
+	uint32_t pixel = x + y * m_Image->Width;
+	glm::vec2 jitter = m_Sampler->Get2D(pixel, PixelPass(pixel), SampleDimension::PixelJitter);
+	return m_Camera.CalculateRayDirection({ x + jitter.x, y + jitter.y });
+}
+
+uint32_t Renderer::PixelPass(uint32_t pixel) const {
+	// without accumulation the sample count stays at 1, which would draw the same samples every frame
+	return m_Settings.Accumulate ? (uint32_t)m_AccumulationData[pixel].w : m_PassIndex;
+}
+
+SampleStream Renderer::BounceSamples(uint32_t pixel, uint32_t sample, int bounce) const {
+	uint32_t pass = PixelPass(pixel);
+	return { m_Sampler.get(), pixel, pass * m_Settings.NumberOfSamples + sample, SampleDimension::FirstBounce + bounce * SampleDimension::PerBounce };
+}
+
+glm::vec3 Renderer::TracePath(const Ray& primaryRay, const HitPayload& primaryHit, uint32_t pixel) {
+	glm::vec3 res = glm::vec3(0.0f);
+	uint64_t segments = 0;
 
-		Ray r = Ray(m_Camera->GetPosition(), m_Camera->GetRayDirection({coord.x, coord.y}));
+	for (int sample = 0; sample < m_Settings.NumberOfSamples; sample++) {
+		PathState path = { primaryRay };
 
 		for (int i = 0; i < m_Settings.NumberOfBounces + 1; i++) {
-			auto payload = TraceRay(r);
+			// the primary ray always hits the same thing, every sample starts from that hit
+			auto payload = i == 0 ? primaryHit : TraceRay(path.CurrentRay);
+			segments++;
 			if (payload.HitDistance < 0) // did not hit object
 				break;
 
-			const Object *Object = m_Scene->Objects[payload.ObjectIndex];
-			const Material &material = m_Scene->Materials[Object->MaterialIndex];
-
-			glm::vec3 emitted_light = material.EmissionColor * material.EmissionStrength;
-			bounce_res += emitted_light * ray_color;
-			ray_color *= material.Albedo;
-			if (glm::length(ray_color) < 0.01f && i > 2) { 
-				break; // Avoid unimportant rays wasting computation
-			}
-
-			r.Origin = payload.WorldPosition + payload.WorldNormal * 0.0001f;
-			r.Direction =
-				glm::reflect(r.Direction, glm::normalize(payload.WorldNormal + material.Roughness * Utils::RandomVector(-1.0f, 1.0f)));
+			if (!Shade(payload, i, BounceSamples(pixel, sample, i), path))
+				break;
 		}
 
-		res += bounce_res;
+		res += path.Radiance;
 	}
+	m_PathSegments += segments;
 
 	return glm::clamp(res / (float)(m_Settings.NumberOfSamples), glm::vec3(0.0f), glm::vec3(1.0f));
 }
 
+bool Renderer::Shade(const HitPayload& payload, int bounce, SampleStream samples, PathState& path) {
+	const Object *Object = m_Scene->Objects[payload.ObjectIndex];
+	const Material &material = m_Materials[Object->MaterialIndex];
+	Ray& r = path.CurrentRay;
+
+	// emitters that are not in the light list are never sampled, so they always count
+	glm::vec3 emission = material.EmissionColor * material.EmissionStrength;
+	if (!m_Lights.IsSampled(payload.ObjectIndex)) {
+		path.Radiance += emission * path.Throughput;
+	} else if (path.BsdfPdf > 0.0f) {
+		float lightPdf = m_Lights.GetPdf(payload.ObjectIndex, r.Origin, payload.WorldPosition, payload.WorldNormal);
+		path.Radiance += emission * path.Throughput * MisWeight(path.BsdfPdf, lightPdf);
+	} else if (path.CountEmission) {
+		path.Radiance += emission * path.Throughput;
+	}
+	if (bounce >= m_Settings.RussianRouletteDepth) {
+		// survive with the probability of the largest throughput component, before paying for a light sample
+		SampleStream rouletteSamples = samples;
+		rouletteSamples.Dimension += SampleDimension::Roulette;
+		float survival = std::min(std::max({ path.Throughput.x, path.Throughput.y, path.Throughput.z }), 1.0f);
+		if (rouletteSamples.Get1D() >= survival)
+			return false;
+		path.Throughput /= survival;
+	}
+
+	const glm::vec3 wo = -r.Direction;
+	const Bsdf bsdf(material, payload.WorldNormal, payload.FrontFace);
+	bool sampleLights = m_Settings.NextEventEstimation && !m_Lights.Empty() && !bsdf.IsSpecular();
+	bool weighted = sampleLights && m_Settings.LightWeighting != MISHeuristic::None;
+	if (sampleLights) {
+		SampleStream lightSamples = samples;
+		lightSamples.Dimension += SampleDimension::Light;
+		path.Radiance += path.Throughput * SampleDirectLight(payload.WorldPosition, payload.WorldNormal, wo, bsdf, lightSamples);
+	}
+
+	SampleStream bsdfSamples = samples;
+	bsdfSamples.Dimension += SampleDimension::Bsdf;
+	float uLobe = bsdfSamples.Get1D();
+	BsdfSample scattered;
+	if (!bsdf.Sample(wo, uLobe, bsdfSamples.Get2D(), scattered))
+		return false; // absorbed
+	float cosTheta = glm::dot(scattered.Direction, payload.WorldNormal);
+	path.Throughput *= scattered.Value * (std::abs(cosTheta) / scattered.Pdf);
+	// light sampling cannot find what is behind a smooth reflection or refraction, only this ray can
+	path.CountEmission = !sampleLights || scattered.Specular;
+	path.BsdfPdf = weighted && !scattered.Specular ? scattered.Pdf : 0.0f;
+	// leave from the side the ray goes to
+	r.Origin = payload.WorldPosition + payload.WorldNormal * (cosTheta > 0.0f ? 0.0001f : -0.0001f);
+	r.Direction = scattered.Direction;
+	return true;
+}
+
+glm::vec3 Renderer::SampleDirectLight(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& wo, const Bsdf& bsdf,
+		SampleStream samples) {
+	LightSample light;
+	float uLight = samples.Get1D();
+	if (!m_Lights.Sample(position, uLight, samples.Get2D(), light))
+		return glm::vec3(0.0f);
+	glm::vec3 f = bsdf.Evaluate(wo, light.Direction);
+	if (f == glm::vec3(0.0f))
+		return glm::vec3(0.0f);
+
+	// stop just short of the light, so it does not shadow itself
+	float cosTheta = glm::dot(normal, light.Direction);
+	Ray shadowRay(position + normal * (cosTheta > 0.0f ? 0.0001f : -0.0001f), light.Direction);
+	if (Occluded(shadowRay, light.Distance * (1.0f - 1e-3f)))
+		return glm::vec3(0.0f);
+
+	float weight = m_Settings.LightWeighting != MISHeuristic::None ? MisWeight(light.Pdf, bsdf.Pdf(wo, light.Direction)) : 1.0f;
+	return light.Emission * f * (std::abs(cosTheta) * weight / light.Pdf);
+}
+
+float Renderer::MisWeight(float pdf, float otherPdf) const {
+	return m_Settings.LightWeighting == MISHeuristic::Power ? Utils::PowerHeuristic(pdf, otherPdf) : Utils::BalanceHeuristic(pdf, otherPdf);
+}
+
 HitPayload Renderer::TraceRay(const Ray &ray) {
 	int objectIndex = -1;
 	float hitDistance = std::numeric_limits<float>::max();
 
-	for (int i = 0; i < m_Scene->Objects.size(); i++) {
-		const Object *object = m_Scene->Objects[i];
-		float newDistance = 0;
-
-		if (object->Hit(ray, 0, hitDistance, newDistance)) {
-			if (newDistance > 0.0 && newDistance < hitDistance) {
-				hitDistance = newDistance;
-				objectIndex = i;
-			}
-		}
-	}
-
-	if (objectIndex < 0)
+	if (!m_TopLevelBVH.Intersect(ray, 0, hitDistance, objectIndex))
 		return Miss(ray);
 
 	return ClosestHit(ray, hitDistance, objectIndex);
 }
 
+bool Renderer::Occluded(const Ray& ray, float tMax) const {
+	return m_TopLevelBVH.Occluded(ray, 0, tMax);
+}
+
 HitPayload Renderer::ClosestHit(const Ray &ray, float hitDistance, int objectIndex) {
 	HitPayload payload;
 	payload.HitDistance = hitDistance;
@@ -221,10 +951,11 @@ HitPayload Renderer::ClosestHit(const Ray &ray, float hitDistance, int objectInd
 
 	const Object *closestObject = m_Scene->Objects[objectIndex];
 
-	glm::vec3 origin = ray.Origin - closestObject->Origin;
-	payload.WorldPosition = origin + hitDistance * ray.Direction;
-	payload.WorldNormal = glm::normalize(payload.WorldPosition);
-	payload.WorldPosition += closestObject->Origin;
+	payload.WorldPosition = ray.At(hitDistance);
+	// facing the ray, surfaces are shaded the same from both sides
+	glm::vec3 normal = closestObject->GetNormal(ray, hitDistance);
+	payload.FrontFace = glm::dot(normal, ray.Direction) < 0.0f;
+	payload.WorldNormal = payload.FrontFace ? normal : -normal;
 
 	return payload;
 }
@@ -300,11 +1031,13 @@ void Renderer::SetupGPUBuffers(const Scene &scene) {
 
 	std::vector<TriangleGPU> triangles;
 	std::vector<MeshGPU> meshes;
+	m_GPUTriangleAreas.clear();
+	m_GPUTriangleMaterials.clear();
 	for (auto& object : scene.Objects) {
 		if (object->GetType() == ObjectType::Mesh) {
 			auto mesh = dynamic_cast<Mesh*>(object);
 			int startTriangleIndex = triangles.size();
-			int triangleCount = mesh->MeshTriangles.size();
+			int triangleCount = mesh->GetTriangleCount();
 			printf("Mesh has %d triangles\n", triangleCount);
 			meshes.push_back({
 					.minBounds = glm::vec4(mesh->BoundingBox.m_Box.pMin, 1.0f),
@@ -312,14 +1045,18 @@ void Renderer::SetupGPUBuffers(const Scene &scene) {
 					.startTriangleIndex = startTriangleIndex,
 					.triangleCount = triangleCount
 					});
-			for (auto& tri : mesh->MeshTriangles) {
+			glm::vec3 translation = mesh->GetTranslation();
+			for (size_t i = 0; i < mesh->GetTriangleCount(); i++) {
+				MeshTriangle tri = mesh->GetTriangle(i);
 				triangles.push_back({
-						.v0 = glm::vec4(tri.Vertices[0], 1.0f),
-						.v1 = glm::vec4(tri.Vertices[1], 1.0f),
-						.v2 = glm::vec4(tri.Vertices[2], 1.0f),
-						.normal = glm::vec4(tri.Normal, 0.0f),   // 0 for directions
-						.materialIndex = tri.MaterialIndex
+						.v0 = glm::vec4(tri[0] + translation, 1.0f),
+						.v1 = glm::vec4(tri[1] + translation, 1.0f),
+						.v2 = glm::vec4(tri[2] + translation, 1.0f),
+						.normal = glm::vec4(tri.GetNormal(), 0.0f),   // 0 for directions
+						.materialIndex = mesh->MaterialIndex
 						});
+				m_GPUTriangleAreas.push_back(0.5f * glm::length(glm::cross(tri[1] - tri[0], tri[2] - tri[0])));
+				m_GPUTriangleMaterials.push_back(mesh->MaterialIndex);
 			}
 		}
 	}
@@ -335,7 +1072,9 @@ void Renderer::SetupGPUBuffers(const Scene &scene) {
 				.Roughness = material.Roughness,
 				.EmissionColor = material.EmissionColor,
 				.EmissionStrength = material.EmissionStrength,
-				.Metallic = material.Metallic
+				.Metallic = material.Metallic,
+				.Transmission = material.Transmission,
+				.IOR = material.IOR
 				});
 	}
 
@@ -369,6 +1108,49 @@ void Renderer::SetupGPUBuffers(const Scene &scene) {
 	m_Shader.Unbind();
 }
 
+void Renderer::UpdateGPULights(const Scene& scene) {
+	std::vector<glm::vec3> emission;
+	emission.reserve(scene.Materials.size());
+	for (auto& material : scene.Materials)
+		emission.push_back(material.EmissionColor * material.EmissionStrength);
+	if (m_LightSSBO && emission == m_GPUEmission)
+		return;
+	m_GPUEmission = emission;
+
+	// only the GPU's triangles, by the power they emit like LightList
+	std::vector<int> lightTriangles;
+	std::vector<float> power;
+	for (size_t i = 0; i < m_GPUTriangleAreas.size(); i++) {
+		int materialIndex = m_GPUTriangleMaterials[i];
+		if (materialIndex < 0 || materialIndex >= (int)emission.size())
+			continue;
+		float trianglePower = Utils::Luminance(emission[materialIndex]) * m_GPUTriangleAreas[i];
+		if (trianglePower > 0.0f) {
+			lightTriangles.push_back((int)i);
+			power.push_back(trianglePower);
+		}
+	}
+	AliasTable table;
+	table.Build(power);
+	m_LightTotalPower = std::accumulate(power.begin(), power.end(), 0.0f);
+
+	std::vector<LightGPU> lights;
+	lights.reserve(table.GetEntries().size());
+	for (size_t i = 0; i < table.GetEntries().size(); i++) {
+		const AliasTable::Entry& entry = table.GetEntries()[i];
+		lights.push_back({ lightTriangles[i], (int)entry.Alias, entry.Probability, entry.Pdf });
+	}
+	m_LightCount = lights.size();
+
+	if (!m_LightSSBO)
+		glGenBuffers(1, &m_LightSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_LightSSBO);
+	// never empty, the shader does not read it without lights
+	LightGPU none = {};
+	glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(lights.size(), 1) * sizeof(LightGPU), lights.empty() ? &none : lights.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
 void Renderer::ResizeGPUTextures(uint32_t width, uint32_t height) {
 	if (width == m_GPUTextureWidth && height == m_GPUTextureHeight)
 		return;
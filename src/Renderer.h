@@ -3,73 +3,317 @@
 #include "RayTracer.h"
 
 #include "Image.h"
+#include "Bsdf.h"
 #include "Camera.h"
+#include "Denoiser.h"
+#include "Lights.h"
 #include "Scene.h"
 
+#include "Sampler.h"
+#include "ThreadPool.h"
+
+#include "Accel/TopLevelBVH.h"
+
 #include "OpenGL/Shader.h"
 #include "OpenGL/Texture.h"
 
 #include <glad/glad.h>
 
+#include <atomic>
+#include <chrono>
+
+// How light found by next event estimation and light hit by BSDF sampled rays are combined
+enum class MISHeuristic
+{
+	None, // lights are sampled unweighted, the emission the next hit finds only counts after a smooth reflection
+	Balance, // every bounce samples a light and both estimates are weighted by their densities
+	Power // like Balance with squared densities, less noise where one of them is clearly better
+};
+
 struct RenderSettings
 {
 	int NumberOfSamples = 1;
 	int NumberOfBounces = 1;
 	bool Accumulate = true;
+	bool PacketTracing = true; // trace primary rays in 8x8 packets on the CPU
+	bool Wavefront = false; // trace every bounce of the CPU paths as one sorted stream of rays
+	uint32_t TileSize = 32; // pixels per side of the tiles handed to the render threads
+	unsigned int ThreadCount = 0; // CPU render threads, 0 uses every core
+	// ms of tracing per shown CPU frame, the next frame carries on with the tiles left over. 0 traces every pixel
+	// each frame. Not used by the wavefront integrator, which works on whole passes.
+	float FrameBudget = 0.0f;
+	// Stop tracing a tile once the noise of every pixel in it (standard error of its luminance over the square root
+	// of the mean) is below AdaptiveThreshold, after at least AdaptiveMinSamples passes. Tile based CPU integrator only.
+	bool AdaptiveSampling = false;
+	float AdaptiveThreshold = 0.02f;
+	uint32_t AdaptiveMinSamples = 16;
+	// Sample a light with a shadow ray at every bounce instead of waiting for paths to hit one
+	bool NextEventEstimation = true;
+	MISHeuristic LightWeighting = MISHeuristic::Power;
+	// Bounces every path gets, after that Russian roulette ends paths with a probability that grows as their
+	// throughput drops and scales up the ones that go on, so the image stays unbiased
+	int RussianRouletteDepth = 3;
+	SamplerType Sampling = SamplerType::Sobol; // numbers the CPU paths and their pixel jitter are built from
+	uint32_t SamplerSeed = 0; // renders with other seeds are uncorrelated, e.g. a reference image
+	// Filter the shown CPU image with the a-trous denoiser once every pixel has a sample, the accumulation stays noisy
+	bool Denoise = false;
+	int DenoiseIterations = Denoiser::DefaultIterations;
+	// Keep the samples of pixels that still see the same surface after a MoveCamera, reprojected to where it is seen
+	// now. At most TemporalHistory passes are carried over so lighting the old view missed fades in. CPU only.
+	bool TemporalReuse = true;
+	uint32_t TemporalHistory = 16;
+
+	bool operator==(const RenderSettings&) const = default;
 };
 
+// CPU frames are rendered on a background thread while the UI keeps running. Render, called once per UI frame,
+// hands the thread the current camera, materials and settings and uploads the newest finished frame. The scene's
+// geometry is read by the render thread directly, so CancelRender must be called before changing it.
 class Renderer
 {
 public:
 	Renderer() = default;
 	~Renderer() {
+		StopRenderThread();
 		delete[] m_AccumulationData;
 		delete m_RenderTexture;
 		if (m_AccumulationTexture) glDeleteTextures(1, &m_AccumulationTexture);
 	}
 
-	void Render(const Scene& scene, Camera& cam);
+	void Render(const Scene& scene, const Camera& cam);
 	void RenderGPU(const Scene& scene, const Camera& cam);
 
-	constexpr void SetSettings(const RenderSettings&& settings) { m_Settings = settings; }
+	void SetSettings(const RenderSettings&& settings) {
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (settings == m_PendingSettings)
+				return;
+			m_PendingSettings = settings;
+			m_Converged = false; // a lower threshold has more to do, the render thread reopens its converged tiles
+		}
+		m_RenderWake.notify_one();
+	}
 
+	// Stops the render thread, call before resizing the image
 	void SetImage(Image& image);
-	void ResetFrameIndex() { m_FrameIndex = 1; }
+	// Restarts accumulation and drops the CPU frame in flight, the camera is picked up again by the next Render
+	void ResetFrameIndex();
+	// ResetFrameIndex for a camera that moved, with TemporalReuse the accumulated samples follow the surfaces instead
+	void MoveCamera();
+	// Drops the CPU frame in flight and waits until the render thread no longer touches the scene. It stays
+	// paused, and accumulation restarts, until the next Render.
+	void CancelRender();
 	void SetRenderGPU(bool gpu) {
 		m_RenderGPU = gpu;
 	}
+	// Passes over the whole image since accumulation restarted, plus one
 	uint32_t GetFrameIndex() const { return m_FrameIndex; }
+	// Paths per second of the last CPU frame
+	double GetSamplesPerSecond() const {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_SamplesPerSecond;
+	}
+	// Rays traced per path in the last CPU frame, the primary ray included
+	double GetAveragePathLength() const {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_AveragePathLength;
+	}
+	// ms the denoiser took on the last CPU frame
+	double GetDenoiseTime() const {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_DenoiseTime;
+	}
+	// Fraction of the pixels adaptive sampling considers done
+	float GetConvergedFraction() const {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_ConvergedFraction;
+	}
+	// Fraction of the last CPU frame every render thread was busy
+	std::vector<float> GetThreadUtilization() const {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_ThreadUtilization;
+	}
+	// Adds passes whole CPU passes to the accumulation on the calling thread, without frame budget or adaptive
+	// sampling, for measuring convergence. CancelRender first to start from zero.
+	void RenderPasses(const Scene& scene, const Camera& cam, uint32_t passes);
+	// Average of every pixel's accumulated samples, not clamped to the displayed range. Render thread paused only.
+	std::vector<glm::vec3> GetAccumulation() const;
 	uint32_t GetRenderID() const {
 		if (!m_RenderGPU) return m_RenderTexture->GetRendererID();
 		else return m_FramebufferTexture;
 	}
 
 private:
+	void RenderThreadLoop();
+	// Renders one CPU frame into the back buffer, false if it was cancelled part way
+	bool RenderFrame();
+	// Traces tiles of the current pass until the frame budget runs out, returns the number of pixels traced
+	uint64_t RenderBudgeted(std::chrono::high_resolution_clock::time_point start);
+	// A pass over the whole image has been accumulated
+	void CompletePass();
+	// Fills m_ActiveTiles with the tiles adaptive sampling has not finished yet
+	void UpdateActiveTiles();
+	// Whether every pixel of a tile has converged, see RenderSettings::AdaptiveThreshold
+	bool IsTileConverged(uint32_t tile) const;
+	void PauseRenderThread();
+	void StopRenderThread();
+	// Uploads the newest finished CPU frame, if there is one the UI has not shown yet
+	void PresentFrame();
+
 	glm::vec3 PerPixel(const glm::vec2&& coord); // comparable to RayGen shader in GPU ray tracing
+	// What a path carries from one bounce to the next
+	struct PathState {
+		Ray CurrentRay;
+		glm::vec3 Throughput = glm::vec3(1.0f);
+		glm::vec3 Radiance = glm::vec3(0.0f);
+		// false after a bounce that sampled a light, which already counted what the next hit emits
+		bool CountEmission = true;
+		// density the ray was scattered with, lights it hits are weighted against light sampling. 0 counts them fully.
+		float BsdfPdf = 0.0f;
+	};
+
+	// Samples the bounces after a primary hit
+	glm::vec3 TracePath(const Ray& primaryRay, const HitPayload& primaryHit, uint32_t pixel);
+	// Adds what the hit emits and the light sampled from it, then scatters the path's ray off it. False once the
+	// path is not worth continuing. samples start at the dimensions of this bounce.
+	bool Shade(const HitPayload& payload, int bounce, SampleStream samples, PathState& path);
+	// Light from a light sampled with a shadow ray, scattered by bsdf towards wo. Weighted against the BSDF sampling
+	// the same light unless LightWeighting is None.
+	glm::vec3 SampleDirectLight(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& wo, const Bsdf& bsdf,
+			SampleStream samples);
+	// Weight of a sample drawn with density pdf against one with otherPdf, by the LightWeighting heuristic
+	float MisWeight(float pdf, float otherPdf) const;
+	// Which pass of the pixel's samples is traced: its sample count, or every pass so far when not accumulating
+	uint32_t PixelPass(uint32_t pixel) const;
+	// Sample stream of a bounce, index counts the samples of the pixel over every pass
+	SampleStream BounceSamples(uint32_t pixel, uint32_t sample, int bounce) const;
+	// Camera ray through a point of the pixel picked by the sampler, a new one every pass
+	glm::vec3 PrimaryRayDirection(uint32_t x, uint32_t y);
+	// Rebuilds the tile list after the image or tile size changed
+	void UpdateTiles();
+	void RenderTile(uint32_t tile);
+	void GetTileRect(uint32_t tile, uint32_t& x0, uint32_t& y0, uint32_t& x1, uint32_t& y1) const;
+	// Traces the primary rays of a tile, in 8x8 packets when PacketTracing is on, and hands every pixel's ray and hit
+	// to pixel(x, y, ray, payload). Without jitter the rays go through the pixel centres.
+	template<typename PixelFn>
+	void TracePrimaryRays(uint32_t tile, PixelFn&& pixel, bool jitter = true);
+	// Writes the features of the first hit through every pixel centre to m_GBuffer and the denoiser
+	void RenderGBuffer();
+	// Moves the accumulated samples from the previous camera's pixels to the current one's, pixels whose surface was
+	// not seen before start over
+	void ReprojectAccumulation();
+	void ReprojectPixel(uint32_t x, uint32_t y);
+	void RenderWavefront();
+	void AccumulatePixel(uint32_t x, uint32_t y, const glm::vec3& color);
+	// Writes the average of a pixel's samples to the back buffer
+	void ResolvePixel(uint32_t x, uint32_t y);
 
 	HitPayload TraceRay(const Ray& ray);
+	// Visibility only: whether anything lies between the ray origin and tMax, without finding the closest hit
+	bool Occluded(const Ray& ray, float tMax) const;
 
 	HitPayload ClosestHit(const Ray& ray, float hitDistance, int objectIndex);
 
 	constexpr HitPayload Miss(const Ray& ray);
 
 	void SetupGPUBuffers(const Scene& scene);
+	// Rebuilds the light buffer when the emission of a material changed
+	void UpdateGPULights(const Scene& scene);
 	void ResizeGPUTextures(uint32_t width, uint32_t height);
 
 	Image* m_Image = nullptr;
-	glm::vec3* m_AccumulationData = nullptr;
+	glm::vec4* m_AccumulationData = nullptr; // sum of the samples, w counts them
+	std::vector<float> m_LuminanceSquares; // sum of the squared luminance of the samples, for their variance
+	bool m_ClearAccumulation = true;
 
 	std::vector<uint32_t> m_ImageVerticalIter;
-	std::vector<uint32_t> m_ImageHorizontalIter;
 
-	Camera* m_Camera = nullptr;
+	std::unique_ptr<Sampler> m_Sampler;
+	SamplerType m_SamplerType = SamplerType::Random;
+	uint32_t m_SamplerSeed = 0;
+
+	std::unique_ptr<ThreadPool> m_ThreadPool;
+	std::vector<uint32_t> m_Tiles; // in Morton order, so neighbouring tiles go to the same thread
+	uint32_t m_TileSize = 0;
+	std::vector<uint32_t> m_PassTiles; // tiles of the current frame budgeted pass that are not traced yet
+	std::vector<uint8_t> m_TileTraced;
+	std::vector<uint8_t> m_TileConverged;
+	std::vector<uint32_t> m_ActiveTiles; // tiles that still need samples
+	std::vector<float> m_ThreadUtilization;
+
+	// Render thread state. m_Mutex guards the pending values and flags, the frame copies are only touched by the
+	// render thread while it is running and by the UI thread while it is paused.
+	std::thread m_RenderThread;
+	mutable std::mutex m_Mutex;
+	std::condition_variable m_RenderWake, m_RenderIdle;
+	bool m_Paused = true, m_Rendering = false, m_StopThread = false;
+	bool m_Converged = false; // every tile is done, the render thread sleeps until something changes
+	float m_ConvergedFraction = 0.0f;
+	bool m_PendingReset = false;
+	bool m_PendingReprojection = false; // overridden by m_PendingReset
+	bool m_CameraChanged = true; // UI thread only, the camera is copied to m_PendingCamera on the next Render
+	bool m_PendingCameraFresh = false;
+	std::atomic<bool> m_Cancel = false; // checked by the workers between tiles
+	RenderSettings m_PendingSettings;
+	const Scene* m_PendingScene = nullptr;
+	Camera m_PendingCamera;
+	std::vector<Material> m_PendingMaterials;
+
+	Camera m_Camera; // of the frame being rendered
+	std::vector<Material> m_Materials;
 	const Scene* m_Scene = nullptr;
 
+	// Triple buffered frames: the render thread fills the back buffer and swaps it with the ready one, the UI
+	// swaps the ready one with its front buffer when it holds a frame it has not shown yet
+	static constexpr uint32_t FreshFrame = 1u << 31;
+	std::vector<uint32_t> m_FrameBuffers[3];
+	uint32_t m_BackBuffer = 0, m_FrontBuffer = 2;
+	std::atomic<uint32_t> m_ReadyBuffer = 1;
+
+	TopLevelBVH m_TopLevelBVH;
+	LightList m_Lights; // of the frame being rendered
+	bool m_LightsValid = false; // for the current scene and materials
+
+	// Wavefront state, kept between frames to reuse the allocations
+	struct WavefrontPath {
+		PathState State;
+		uint32_t Pixel;
+		bool Active;
+	};
+	std::vector<Ray> m_PrimaryRays; // per pixel
+	std::vector<HitPayload> m_PrimaryHits; // per pixel
+	std::vector<glm::vec3> m_PixelRadiance; // sum over the samples of this frame
+	std::vector<WavefrontPath> m_Paths, m_SortedPaths;
+	std::vector<uint64_t> m_RayKeys; // direction octant and origin cell above the path index
+	std::vector<HitPayload> m_PathHits;
+
+	Denoiser m_Denoiser;
+	bool m_GBufferValid = false; // for the current camera and scene
+	bool m_PassCompleted = false; // every pixel has a sample since the accumulation was cleared
+	double m_DenoiseTime = 0.0;
+
+	// Temporal reuse
+	struct GBuffer
+	{
+		std::vector<glm::vec4> NormalDepth; // world normal and hit distance of the first hit, a negative distance for a miss
+		glm::mat4 ViewProjection; // of the camera it was rendered with
+		glm::vec3 Origin;
+	};
+	GBuffer m_GBuffer, m_PreviousGBuffer;
+	bool m_ReprojectAccumulation = false; // on the next frame, rather than clearing
+	std::vector<glm::vec4> m_AccumulationHistory; // what the accumulation held before the reprojection
+	std::vector<float> m_LuminanceSquaresHistory;
+
+	double m_SamplesPerSecond = 0.0;
+	double m_AveragePathLength = 0.0;
+	std::atomic<uint64_t> m_PathSegments = 0; // rays traced by the paths of the frame being rendered
+
 	Texture* m_RenderTexture = new Texture(0, 0);
 
 	RenderSettings m_Settings;
 
-	uint32_t m_FrameIndex = 1;
+	std::atomic<uint32_t> m_FrameIndex = 1;
+	uint32_t m_PassIndex = 0; // CPU passes completed, never reset
 
 	bool m_RenderGPU = false;
 	bool m_GPUSetup = false;
@@ -97,7 +341,17 @@ private:
 		glm::vec3 EmissionColor;
 		float EmissionStrength;
 		float Metallic;
-		float padding[3]; // Padding to ensure 16-byte alignment
+		float Transmission;
+		float IOR;
+		float padding; // Padding to ensure 16-byte alignment
+	};
+
+	// An emissive triangle and its slot of the alias table
+	struct LightGPU {
+		int TriangleIndex;
+		int Alias;
+		float Probability;
+		float Pdf;
 	};
 
 	Shader m_Shader = Shader("../src/shaders/vertex.glsl", "../src/shaders/fragment.glsl");
@@ -107,4 +361,9 @@ private:
 	uint32_t m_AccumulationTexture = 0;
 	uint32_t m_GPUTextureWidth = 0, m_GPUTextureHeight = 0;
 	uint32_t m_TriangleSSBO, m_MeshSSBO, m_MaterialSSBO;
+	uint32_t m_LightSSBO = 0, m_LightCount = 0;
+	float m_LightTotalPower = 0.0f;
+	std::vector<float> m_GPUTriangleAreas;
+	std::vector<int> m_GPUTriangleMaterials;
+	std::vector<glm::vec3> m_GPUEmission; // per material, of the last light buffer
 };
@@ -0,0 +1,261 @@
+#include "Sampler.h"
+
+#include <array>
+
+namespace {
+	// [0, 1) from the top 24 bits, so the result never rounds up to 1
+	inline float ToUnitFloat(uint32_t bits)
+	{
+		return (float)(bits >> 8) * 0x1p-24f;
+	}
+
+	inline uint32_t HashCombine(uint32_t seed, uint32_t value)
+	{
+		return Utils::PcgHash(seed + value);
+	}
+
+	inline uint32_t ReverseBits(uint32_t x)
+	{
+		x = (x << 16) | (x >> 16);
+		x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+		x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+		x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+		x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+		return x;
+	}
+
+	// Owen scrambling of a 32 bit fixed point number, every bit flipped depending on the bits above it
+	inline uint32_t NestedUniformScramble(uint32_t x, uint32_t seed)
+	{
+		x = ReverseBits(x);
+		// Laine-Karras permutation with Burley's constants, only carries upwards so it scrambles in base 2
+		x ^= x * 0x3d20adea;
+		x += seed;
+		x *= (seed >> 16) | 1;
+		x ^= x * 0x05526c56;
+		x ^= x * 0x53a22864;
+		return ReverseBits(x);
+	}
+
+	// Generator matrices of the first four Sobol dimensions (Joe and Kuo), one column per bit of the index
+	constexpr std::array<std::array<uint32_t, 32>, 4> BuildSobolMatrices()
+	{
+		struct Polynomial { uint32_t Degree, Coefficients, Initial[3]; };
+		constexpr Polynomial polynomials[3] = { { 1, 0, { 1 } }, { 2, 1, { 1, 3 } }, { 3, 1, { 1, 3, 1 } } };
+
+		std::array<std::array<uint32_t, 32>, 4> matrices{};
+		for (uint32_t bit = 0; bit < 32; bit++)
+			matrices[0][bit] = 1u << (31 - bit); // van der Corput
+		for (uint32_t d = 1; d < 4; d++) {
+			const Polynomial& p = polynomials[d - 1];
+			std::array<uint32_t, 32>& v = matrices[d];
+			for (uint32_t bit = 0; bit < 32; bit++) {
+				if (bit < p.Degree) {
+					v[bit] = p.Initial[bit] << (31 - bit);
+					continue;
+				}
+				v[bit] = v[bit - p.Degree] ^ (v[bit - p.Degree] >> p.Degree);
+				for (uint32_t k = 1; k < p.Degree; k++) {
+					if ((p.Coefficients >> (p.Degree - 1 - k)) & 1)
+						v[bit] ^= v[bit - k];
+				}
+			}
+		}
+		return matrices;
+	}
+
+	// The matrix times every value of each byte of the index, the shuffled indices use all 32 bits and a loop over
+	// them is several times slower
+	using SobolTable = std::array<std::array<std::array<uint32_t, 256>, 4>, 4>;
+	SobolTable BuildSobolTables()
+	{
+		constexpr std::array<std::array<uint32_t, 32>, 4> matrices = BuildSobolMatrices();
+		SobolTable tables{};
+		for (uint32_t d = 0; d < 4; d++) {
+			for (uint32_t byte = 0; byte < 4; byte++) {
+				for (uint32_t value = 0; value < 256; value++) {
+					uint32_t x = 0;
+					for (uint32_t bit = 0; bit < 8; bit++) {
+						if ((value >> bit) & 1)
+							x ^= matrices[d][byte * 8 + bit];
+					}
+					tables[d][byte][value] = x;
+				}
+			}
+		}
+		return tables;
+	}
+	const SobolTable SobolTables = BuildSobolTables();
+
+	inline uint32_t Sobol(uint32_t index, uint32_t dimension)
+	{
+		const std::array<std::array<uint32_t, 256>, 4>& table = SobolTables[dimension];
+		return table[0][index & 0xff] ^ table[1][(index >> 8) & 0xff] ^ table[2][(index >> 16) & 0xff] ^ table[3][index >> 24];
+	}
+
+	// Shuffled and scrambled Sobol point, dimensions past the fourth repeat the first four with other seeds
+	inline uint32_t ScrambledSobol(uint32_t index, uint32_t dimension, uint32_t seed)
+	{
+		uint32_t groupSeed = HashCombine(seed, dimension / 4);
+		uint32_t shuffled = NestedUniformScramble(index, groupSeed);
+		return NestedUniformScramble(Sobol(shuffled, dimension % 4), HashCombine(groupSeed, dimension % 4 + 1));
+	}
+
+	// Void and cluster (Ulichney 1993) ranks of a tileable mask, as values in (0, 1)
+	std::vector<float> BuildBlueNoiseMask()
+	{
+		constexpr uint32_t size = BlueNoiseSampler::MaskSize, count = size * size;
+		constexpr float sigma = 1.5f;
+
+		std::vector<float> kernel(count);
+		for (uint32_t y = 0; y < size; y++) {
+			for (uint32_t x = 0; x < size; x++) {
+				float dx = (float)std::min(x, size - x), dy = (float)std::min(y, size - y);
+				kernel[x + y * size] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+			}
+		}
+
+		std::vector<uint8_t> pattern(count, 0);
+		std::vector<float> energy(count, 0.0f);
+		auto set = [&](uint32_t p, bool value) {
+			pattern[p] = value;
+			float sign = value ? 1.0f : -1.0f;
+			uint32_t px = p % size, py = p / size;
+			for (uint32_t y = 0; y < size; y++) {
+				for (uint32_t x = 0; x < size; x++)
+					energy[x + y * size] += sign * kernel[((x - px) & (size - 1)) + ((y - py) & (size - 1)) * size];
+			}
+		};
+		// densest point of the pattern, or emptiest spot outside it
+		auto tightestCluster = [&]() {
+			uint32_t best = 0;
+			float bestEnergy = -1.0f;
+			for (uint32_t p = 0; p < count; p++) {
+				if (pattern[p] && energy[p] > bestEnergy) {
+					best = p;
+					bestEnergy = energy[p];
+				}
+			}
+			return best;
+		};
+		auto largestVoid = [&]() {
+			uint32_t best = 0;
+			float bestEnergy = std::numeric_limits<float>::max();
+			for (uint32_t p = 0; p < count; p++) {
+				if (!pattern[p] && energy[p] < bestEnergy) {
+					best = p;
+					bestEnergy = energy[p];
+				}
+			}
+			return best;
+		};
+
+		// a tenth of the texels at random, then moved from clusters into voids until evenly spread
+		uint32_t initialCount = count / 10;
+		for (uint32_t i = 0, placed = 0; placed < initialCount; i++) {
+			uint32_t p = Utils::PcgHash(i) % count;
+			if (!pattern[p]) {
+				set(p, true);
+				placed++;
+			}
+		}
+		for (;;) {
+			uint32_t cluster = tightestCluster();
+			set(cluster, false);
+			uint32_t gap = largestVoid();
+			set(gap, true);
+			if (gap == cluster)
+				break;
+		}
+
+		std::vector<uint32_t> rank(count);
+		std::vector<uint8_t> initialPattern = pattern;
+		std::vector<float> initialEnergy = energy;
+		for (uint32_t r = initialCount; r-- > 0;) {
+			uint32_t cluster = tightestCluster();
+			set(cluster, false);
+			rank[cluster] = r;
+		}
+		// the largest void of the ones is also the tightest cluster of the zeros, so one loop fills the rest
+		pattern = initialPattern;
+		energy = initialEnergy;
+		for (uint32_t r = initialCount; r < count; r++) {
+			uint32_t gap = largestVoid();
+			set(gap, true);
+			rank[gap] = r;
+		}
+
+		std::vector<float> mask(count);
+		for (uint32_t p = 0; p < count; p++)
+			mask[p] = (rank[p] + 0.5f) / count;
+		return mask;
+	}
+}
+
+std::unique_ptr<Sampler> Sampler::Create(SamplerType type, uint32_t imageWidth, uint32_t seed)
+{
+	switch (type) {
+		case SamplerType::Stratified: return std::make_unique<StratifiedSampler>(seed);
+		case SamplerType::Sobol: return std::make_unique<SobolSampler>(seed);
+		case SamplerType::BlueNoise: return std::make_unique<BlueNoiseSampler>(imageWidth, seed);
+		default: return std::make_unique<RandomSampler>(seed);
+	}
+}
+
+float RandomSampler::Get1D(uint32_t pixel, uint32_t index, uint32_t dimension) const
+{
+	return ToUnitFloat(Utils::PcgHash(HashCombine(HashCombine(PixelSeed(pixel), index), dimension)));
+}
+
+glm::vec2 RandomSampler::Get2D(uint32_t pixel, uint32_t index, uint32_t dimension) const
+{
+	return { Get1D(pixel, index, dimension), Get1D(pixel, index, dimension + 1) };
+}
+
+float StratifiedSampler::Get1D(uint32_t pixel, uint32_t index, uint32_t dimension) const
+{
+	// every block of samples visits each stratum once, in an order of its own
+	uint32_t seed = HashCombine(HashCombine(PixelSeed(pixel), dimension), index / BlockSize);
+	uint32_t stratum = ((index % BlockSize) * (2 * (seed >> 4) + 1) + seed) % BlockSize;
+	return (stratum + ToUnitFloat(Utils::PcgHash(seed + index))) / BlockSize;
+}
+
+glm::vec2 StratifiedSampler::Get2D(uint32_t pixel, uint32_t index, uint32_t dimension) const
+{
+	constexpr uint32_t side = 4; // square root of BlockSize
+	uint32_t seed = HashCombine(HashCombine(PixelSeed(pixel), dimension), index / BlockSize);
+	uint32_t stratum = ((index % BlockSize) * (2 * (seed >> 4) + 1) + seed) % BlockSize;
+	uint32_t jitter = Utils::PcgHash(seed + index);
+	return { (stratum % side + ToUnitFloat(jitter)) / side, (stratum / side + ToUnitFloat(Utils::PcgHash(jitter))) / side };
+}
+
+float SobolSampler::Get1D(uint32_t pixel, uint32_t index, uint32_t dimension) const
+{
+	return ToUnitFloat(ScrambledSobol(index, dimension, PixelSeed(pixel)));
+}
+
+glm::vec2 SobolSampler::Get2D(uint32_t pixel, uint32_t index, uint32_t dimension) const
+{
+	return { Get1D(pixel, index, dimension), Get1D(pixel, index, dimension + 1) };
+}
+
+float BlueNoiseSampler::MaskValue(uint32_t pixel, uint32_t dimension) const
+{
+	static const std::vector<float> mask = BuildBlueNoiseMask();
+
+	// every dimension reads the mask shifted by its own offset, so they are not correlated
+	uint32_t offset = HashCombine(m_Seed, dimension);
+	uint32_t x = pixel % m_ImageWidth + offset, y = pixel / m_ImageWidth + (offset >> 16);
+	return mask[(x % MaskSize) + (y % MaskSize) * MaskSize];
+}
+
+float BlueNoiseSampler::Get1D(uint32_t pixel, uint32_t index, uint32_t dimension) const
+{
+	float u = ToUnitFloat(ScrambledSobol(index, dimension, Utils::PcgHash(m_Seed))) + MaskValue(pixel, dimension);
+	return u < 1.0f ? u : u - 1.0f;
+}
+
+glm::vec2 BlueNoiseSampler::Get2D(uint32_t pixel, uint32_t index, uint32_t dimension) const
+{
+	return { Get1D(pixel, index, dimension), Get1D(pixel, index, dimension + 1) };
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "RayTracer.h"
+
+enum class SamplerType
+{
+	Random, // independent PCG hashes, the slowest to converge
+	Stratified, // jittered strata over every block of 16 samples of a pixel
+	Sobol, // Owen scrambled Sobol sequence, shuffled per pixel
+	BlueNoise // one Sobol sequence for the whole image, offset per pixel by a blue noise mask
+};
+
+// Where each use of random numbers along a path reads from, so none of them share dimensions. PixelJitter is drawn
+// once per pass (the primary hit is shared by the samples of a pass), the rest once per sample and bounce. Blocks
+// start on multiples of 4, which the Sobol sampler stratifies together.
+namespace SampleDimension
+{
+	static constexpr uint32_t PixelJitter = 0; // 2D
+	static constexpr uint32_t FirstBounce = 4;
+	static constexpr uint32_t Bsdf = 0; // from the start of a bounce, the lobe then up to 3 for the direction
+	static constexpr uint32_t Light = 4; // the light then 2D for the point on it
+	static constexpr uint32_t Roulette = 7;
+	static constexpr uint32_t PerBounce = 8;
+}
+
+// Supplies the numbers in [0, 1) a pixel's paths are built from. The value of a dimension depends only on the pixel,
+// the sample index and the dimension, so samplers are stateless and can be shared by every render thread.
+class Sampler
+{
+public:
+	virtual ~Sampler() = default;
+
+	// Pixel indices are x + y * imageWidth. Samplers with different seeds give uncorrelated numbers.
+	static std::unique_ptr<Sampler> Create(SamplerType type, uint32_t imageWidth, uint32_t seed = 0);
+
+	virtual float Get1D(uint32_t pixel, uint32_t index, uint32_t dimension) const = 0;
+	// dimension and dimension + 1, stratified together where the sampler can
+	virtual glm::vec2 Get2D(uint32_t pixel, uint32_t index, uint32_t dimension) const = 0;
+
+protected:
+	explicit Sampler(uint32_t seed) : m_Seed(seed) {}
+
+	// where the numbers of a pixel start
+	uint32_t PixelSeed(uint32_t pixel) const { return Utils::PcgHash(Utils::PcgHash(m_Seed) + pixel); }
+
+	uint32_t m_Seed;
+};
+
+// Consecutive dimensions of one sample, handed to the code that consumes them
+struct SampleStream
+{
+	const Sampler* Source;
+	uint32_t Pixel;
+	uint32_t Index;
+	uint32_t Dimension;
+
+	float Get1D() { return Source->Get1D(Pixel, Index, Dimension++); }
+	glm::vec2 Get2D() {
+		glm::vec2 u = Source->Get2D(Pixel, Index, Dimension);
+		Dimension += 2;
+		return u;
+	}
+};
+
+class RandomSampler : public Sampler
+{
+public:
+	explicit RandomSampler(uint32_t seed = 0) : Sampler(seed) {}
+
+	float Get1D(uint32_t pixel, uint32_t index, uint32_t dimension) const override;
+	glm::vec2 Get2D(uint32_t pixel, uint32_t index, uint32_t dimension) const override;
+};
+
+class StratifiedSampler : public Sampler
+{
+public:
+	explicit StratifiedSampler(uint32_t seed = 0) : Sampler(seed) {}
+
+	float Get1D(uint32_t pixel, uint32_t index, uint32_t dimension) const override;
+	glm::vec2 Get2D(uint32_t pixel, uint32_t index, uint32_t dimension) const override;
+
+	static constexpr uint32_t BlockSize = 16; // samples per set of strata, a square number
+};
+
+// Burley 2020, "Practical Hash-based Owen Scrambling". Dimensions are padded from the first four of the Sobol
+// sequence, every group of four with its own shuffle of the sample index.
+class SobolSampler : public Sampler
+{
+public:
+	explicit SobolSampler(uint32_t seed = 0) : Sampler(seed) {}
+
+	float Get1D(uint32_t pixel, uint32_t index, uint32_t dimension) const override;
+	glm::vec2 Get2D(uint32_t pixel, uint32_t index, uint32_t dimension) const override;
+};
+
+// Every pixel follows the same scrambled Sobol sequence, shifted (Cranley-Patterson rotation) by a 64x64 blue noise
+// mask, so the error left after a few samples is spread like blue noise instead of white noise
+class BlueNoiseSampler : public Sampler
+{
+public:
+	// the image width picks the mask texel of a pixel index
+	BlueNoiseSampler(uint32_t imageWidth, uint32_t seed = 0) : Sampler(seed), m_ImageWidth(imageWidth) {}
+
+	float Get1D(uint32_t pixel, uint32_t index, uint32_t dimension) const override;
+	glm::vec2 Get2D(uint32_t pixel, uint32_t index, uint32_t dimension) const override;
+
+	static constexpr uint32_t MaskSize = 64;
+
+private:
+	float MaskValue(uint32_t pixel, uint32_t dimension) const;
+
+	uint32_t m_ImageWidth;
+};
@@ -0,0 +1,121 @@
+#include "ThreadPool.h"
+
+#include <chrono>
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+	if (threadCount == 0)
+		threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+	m_Workers.resize(threadCount);
+	m_Utilization.assign(threadCount, 0.0f);
+	for (auto& worker : m_Workers)
+		worker = std::make_unique<Worker>();
+	for (uint32_t i = 0; i < threadCount; i++)
+		m_Workers[i]->Thread = std::thread(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+	}
+	m_WorkReady.notify_all();
+	for (auto& worker : m_Workers)
+		worker->Thread.join();
+}
+
+void ThreadPool::Run(const std::vector<uint32_t>& tiles, const std::function<void(uint32_t)>& fn)
+{
+	if (tiles.empty())
+		return;
+
+	std::chrono::time_point <std::chrono::high_resolution_clock> start, end;
+	start = std::chrono::high_resolution_clock::now();
+
+	// every worker is idle between runs, so the queues can be filled without racing them
+	uint32_t workerCount = (uint32_t)m_Workers.size();
+	for (uint32_t i = 0; i < workerCount; i++) {
+		Worker& worker = *m_Workers[i];
+		std::lock_guard<std::mutex> lock(worker.Mutex);
+		worker.Tiles.assign(tiles.begin() + tiles.size() * i / workerCount, tiles.begin() + tiles.size() * (i + 1) / workerCount);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Fn = &fn;
+		m_RunningWorkers = workerCount;
+		m_Generation++;
+		m_WorkReady.notify_all();
+		m_WorkDone.wait(lock, [this] { return m_RunningWorkers == 0; });
+		m_Fn = nullptr;
+	}
+
+	end = std::chrono::high_resolution_clock::now();
+	int64_t duration = std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count(), 1);
+	m_StolenTiles = 0;
+	for (uint32_t i = 0; i < workerCount; i++) {
+		m_Utilization[i] = std::min((float)m_Workers[i]->BusyTime / duration, 1.0f);
+		m_StolenTiles += m_Workers[i]->Stolen;
+	}
+}
+
+void ThreadPool::WorkerLoop(uint32_t index)
+{
+	Worker& worker = *m_Workers[index];
+	uint64_t generation = 0;
+	for (;;) {
+		const std::function<void(uint32_t)>* fn;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_WorkReady.wait(lock, [&] { return m_Stop || m_Generation != generation; });
+			if (m_Stop)
+				return;
+			generation = m_Generation;
+			fn = m_Fn;
+		}
+
+		worker.BusyTime = 0;
+		worker.Stolen = 0;
+		uint32_t tile;
+		while (PopTile(index, tile)) {
+			auto start = std::chrono::high_resolution_clock::now();
+			(*fn)(tile);
+			auto end = std::chrono::high_resolution_clock::now();
+			worker.BusyTime += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+		}
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (--m_RunningWorkers == 0)
+			m_WorkDone.notify_one();
+	}
+}
+
+bool ThreadPool::PopTile(uint32_t index, uint32_t& tile)
+{
+	{
+		Worker& worker = *m_Workers[index];
+		std::lock_guard<std::mutex> lock(worker.Mutex);
+		if (!worker.Tiles.empty()) {
+			tile = worker.Tiles.front();
+			worker.Tiles.pop_front();
+			return true;
+		}
+	}
+
+	// Steal the tile furthest from where the victim is working. No tiles are added during a run, so once every
+	// queue is empty this worker is done.
+	uint32_t workerCount = (uint32_t)m_Workers.size();
+	for (uint32_t i = 1; i < workerCount; i++) {
+		Worker& victim = *m_Workers[(index + i) % workerCount];
+		std::lock_guard<std::mutex> lock(victim.Mutex);
+		if (!victim.Tiles.empty()) {
+			tile = victim.Tiles.back();
+			victim.Tiles.pop_back();
+			m_Workers[index]->Stolen++;
+			return true;
+		}
+	}
+	return false;
+}
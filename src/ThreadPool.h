@@ -0,0 +1,59 @@
+#pragma once
+
+#include "RayTracer.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Render threads that live as long as the renderer. Run deals the tiles of a frame out to the workers in the order
+// given, contiguous runs so every thread starts on its own part of the image, and a worker that runs out steals
+// from the back of another's queue.
+class ThreadPool
+{
+public:
+	// 0 uses every core
+	explicit ThreadPool(unsigned int threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Calls fn(tile) for every tile on the workers, returns once all of them are done
+	void Run(const std::vector<uint32_t>& tiles, const std::function<void(uint32_t)>& fn);
+
+	unsigned int GetThreadCount() const { return (unsigned int)m_Workers.size(); }
+
+	// Fraction of the last Run every thread spent rendering tiles, the rest it spent waiting on the others
+	const std::vector<float>& GetUtilization() const { return m_Utilization; }
+	// Tiles of the last Run that were stolen from another thread's queue
+	uint32_t GetStolenTiles() const { return m_StolenTiles; }
+
+private:
+	struct Worker
+	{
+		std::thread Thread;
+		std::mutex Mutex; // guards Tiles
+		std::deque<uint32_t> Tiles;
+		long BusyTime = 0; // us inside fn during the last Run
+		uint32_t Stolen = 0;
+	};
+
+	void WorkerLoop(uint32_t index);
+	// Next tile for a worker, from the front of its own queue or the back of someone else's
+	bool PopTile(uint32_t index, uint32_t& tile);
+
+	std::vector<std::unique_ptr<Worker>> m_Workers;
+
+	std::mutex m_Mutex; // guards everything below
+	std::condition_variable m_WorkReady, m_WorkDone;
+	const std::function<void(uint32_t)>* m_Fn = nullptr;
+	uint64_t m_Generation = 0; // bumped by every Run
+	uint32_t m_RunningWorkers = 0;
+	bool m_Stop = false;
+
+	std::vector<float> m_Utilization;
+	uint32_t m_StolenTiles = 0;
+};
@@ -1,5 +1,7 @@
 #include "RayTracer.h"
 
+#include "Accel/Simd.h"
+#include "Accel/TriangleData.h"
 #include "ImageWriter.h"
 #include "Objects/Box.h"
 #include "Objects/Plane.h"
@@ -20,6 +22,10 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#include <random>
+#include <thread>
+#include <string.h>
+
 // TODO: TRIANGLE MESHES AND PERHAPS GPU
 
 // GPU STUFF NEEDS TO BE REFACTORED INTO SEPARATE FILE
@@ -45,17 +51,29 @@ struct MaterialGPU {
 	glm::vec3 EmissionColor;
 	float EmissionStrength;
 	float Metallic;
-	float padding[3]; // Padding to ensure 16-byte alignment
+	float Transmission;
+	float IOR;
+	float padding; // Padding to ensure 16-byte alignment
 };
 
-void DisplayObjects(Scene& scene);
-void DisplayMaterials(Scene& scene);
+void DisplayObjects(Scene& scene, Renderer& renderer);
+bool DisplayMaterials(Scene& scene);
+void RunSamplerBenchmark(Renderer& renderer, const Scene& scene, const Camera& cam, uint32_t referencePasses);
+bool RunTriangleKernelCheck(uint32_t rayCount);
+bool RunFrameBudgetCheck(Renderer& renderer, const Scene& scene, const Camera& cam);
 
-int main() {
+// --sampler-benchmark [reference samples] prints the error of every CPU sampler against the sample count and exits
+// --frame-budget-check renders with a budget far below one tile's cost, exits with 1 if the passes stop completing
+// --triangle-kernel-check [rays] compares the SIMD triangle kernels with the scalar test, exits with 1 on a mismatch
+int main(int argc, char** argv) {
 	constexpr int image_width = 1280;
 	constexpr float aspect_ratio = 16.0f / 9.0f;
 	constexpr int image_height = static_cast<int>(image_width / aspect_ratio);
 
+	// needs no window
+	if (argc > 1 && strcmp(argv[1], "--triangle-kernel-check") == 0)
+		return RunTriangleKernelCheck(argc > 2 ? (uint32_t)atoi(argv[2]) : 400000) ? 0 : 1;
+
 	// window must be created before using any OpenGL
 	Window window(2000, 1100, "RayTracer");
 	// initialize input system
@@ -96,6 +114,13 @@ int main() {
 				.EmissionColor = glm::vec3(0.0f, 0.0f, 0.0f),
 				.EmissionStrength = 0.0f}));
 
+	if (argc > 1 && strcmp(argv[1], "--sampler-benchmark") == 0) {
+		RunSamplerBenchmark(renderer, scene, cam, argc > 2 ? (uint32_t)atoi(argv[2]) : 1024);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "--frame-budget-check") == 0)
+		return RunFrameBudgetCheck(renderer, scene, cam) ? 0 : 1;
+
 	renderer.SetImage(img);
 	renderer.Render(scene, cam);
 
@@ -108,6 +133,21 @@ int main() {
 		static int bounces = 3;
 		static bool accumulate = true;
 		static bool gpu = true;
+		static bool packetTracing = true;
+		static bool wavefront = false;
+		static int tileSize = 32;
+		static int threadCount = 0;
+		static float frameBudget = 16.0f;
+		static bool adaptiveSampling = false;
+		static float adaptiveThreshold = 0.02f;
+		static int sampler = (int)SamplerType::Sobol;
+		static bool nextEventEstimation = true;
+		static int lightWeighting = (int)MISHeuristic::Power;
+		static int russianRouletteDepth = 3;
+		static bool denoise = false;
+		static int denoiseIterations = Denoiser::DefaultIterations;
+		static bool temporalReuse = true;
+		static int temporalHistory = 16;
 
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -119,11 +159,48 @@ int main() {
 		ImGui::Begin("Settings");
 		ImGui::SliderInt("Samples", &samples, 1, 100);
 		ImGui::SliderInt("Bounces", &bounces, 0, 100);
+		ImGui::SliderInt("Russian Roulette Depth", &russianRouletteDepth, 0, 100);
 		ImGui::Checkbox("Accumulate", &accumulate);
 		ImGui::Checkbox("GPU", &gpu);
+		ImGui::Checkbox("Packet Tracing", &packetTracing);
+		ImGui::Checkbox("Wavefront", &wavefront);
+		ImGui::SliderInt("Tile Size", &tileSize, 8, 128);
+		ImGui::SliderInt("Threads (0 = all)", &threadCount, 0, (int)std::thread::hardware_concurrency());
+		ImGui::SliderFloat("Frame Budget (ms, 0 = off)", &frameBudget, 0.0f, 100.0f);
+		if (ImGui::Combo("Sampler", &sampler, "Random\0Stratified\0Sobol\0Blue Noise\0"))
+			renderer.ResetFrameIndex();
+		if (ImGui::Checkbox("Next Event Estimation", &nextEventEstimation))
+			renderer.ResetFrameIndex();
+		if (nextEventEstimation && ImGui::Combo("Light Weighting (MIS)", &lightWeighting, "None\0Balance\0Power\0"))
+			renderer.ResetFrameIndex();
+		ImGui::Checkbox("Adaptive Sampling", &adaptiveSampling);
+		if (adaptiveSampling) {
+			ImGui::SliderFloat("Noise Threshold", &adaptiveThreshold, 0.001f, 0.2f);
+			ImGui::Text("Converged: %.1f%%", renderer.GetConvergedFraction() * 100.0f);
+		}
+		ImGui::Checkbox("Denoise", &denoise);
+		if (denoise)
+			ImGui::SliderInt("Denoise Iterations", &denoiseIterations, 1, Denoiser::MaxIterations);
+		ImGui::Checkbox("Temporal Reuse", &temporalReuse);
+		if (temporalReuse)
+			ImGui::SliderInt("History (passes)", &temporalHistory, 1, 64);
 		renderer.SetRenderGPU(gpu);
+		static bool compressedBVH = false;
+		if (ImGui::Checkbox("Compressed BVH", &compressedBVH)) {
+			renderer.CancelRender();
+			for (auto& object : scene.Objects) {
+				if (object->GetType() == ObjectType::Mesh)
+					dynamic_cast<Mesh*>(object)->SetBVHLayout(compressedBVH ? BVHLayout::Quantized : BVHLayout::Wide);
+			}
+		}
 		ImGui::Text("Frame (accumulation): %d", renderer.GetFrameIndex());
 		ImGui::Text("Frame Time: %.3fms", frametime * 1000);
+		if (!gpu) {
+			ImGui::Text("Samples/s: %.2fM", renderer.GetSamplesPerSecond() / 1e6);
+			ImGui::Text("Path length: %.2f rays", renderer.GetAveragePathLength());
+			if (denoise)
+				ImGui::Text("Denoiser: %.2fms", renderer.GetDenoiseTime());
+		}
 		ImGui::End();
 
 		ImGui::Begin("Debug");
@@ -131,12 +208,37 @@ int main() {
 		auto dir = cam.GetForwardDirection();
 		ImGui::Text("Camera Position: (%.2f, %.2f, %.2f)", pos.x, pos.y, pos.z);
 		ImGui::Text("Camera Direction: (%.2f, %.2f, %.2f)", dir.x, dir.y, dir.z);
+		size_t triangleCount = 0, triangleBytes = 0, accelerationBytes = 0;
+		for (auto& object : scene.Objects) {
+			if (object->GetType() != ObjectType::Mesh)
+				continue;
+			auto mesh = dynamic_cast<Mesh*>(object);
+			triangleCount += mesh->GetTriangleCount();
+			triangleBytes += mesh->GetTriangleBytes();
+			accelerationBytes += mesh->GetAccelerationBytes();
+		}
+		if (triangleCount > 0) {
+			ImGui::Text("Triangles: %.1f bytes/triangle", (double)triangleBytes / triangleCount);
+			ImGui::Text("BVH: %.1f bytes/triangle", (double)accelerationBytes / triangleCount);
+		}
+		if (!gpu) {
+			const std::vector<float>& utilization = renderer.GetThreadUtilization();
+			for (size_t i = 0; i < utilization.size(); i++)
+				ImGui::Text("Thread %zu: %.0f%% busy", i, utilization[i] * 100.0f);
+		}
 		ImGui::End();
 
-		renderer.SetSettings({ .NumberOfSamples = samples, .NumberOfBounces = bounces, .Accumulate = accumulate });
+		renderer.SetSettings({ .NumberOfSamples = samples, .NumberOfBounces = bounces, .Accumulate = accumulate, .PacketTracing = packetTracing, .Wavefront = wavefront,
+				.TileSize = (uint32_t)tileSize, .ThreadCount = (unsigned int)threadCount, .FrameBudget = frameBudget,
+				.AdaptiveSampling = adaptiveSampling, .AdaptiveThreshold = adaptiveThreshold,
+				.NextEventEstimation = nextEventEstimation, .LightWeighting = (MISHeuristic)lightWeighting,
+				.RussianRouletteDepth = russianRouletteDepth, .Sampling = (SamplerType)sampler,
+				.Denoise = denoise, .DenoiseIterations = denoiseIterations,
+				.TemporalReuse = temporalReuse, .TemporalHistory = (uint32_t)temporalHistory });
 
-		DisplayObjects(scene);
-		DisplayMaterials(scene);
+		DisplayObjects(scene, renderer);
+		if (DisplayMaterials(scene))
+			renderer.ResetFrameIndex();
 
 		ImGui::Begin("Image");
 		ImVec2 contentRegion = ImGui::GetContentRegionAvail();
@@ -145,6 +247,7 @@ int main() {
 
 		// Resize if window size changed (with minimum size to avoid issues)
 		if (newWidth > 10 && newHeight > 10 && (newWidth != img.Width || newHeight != img.Height)) {
+			renderer.CancelRender();
 			img.Resize(newWidth, newHeight);
 			cam.Resize(newWidth, newHeight);
 			renderer.SetImage(img);
@@ -157,7 +260,7 @@ int main() {
 		window.EndImGui();
 		window.Update();
 		if (cam.Update()) {
-			renderer.ResetFrameIndex();
+			renderer.MoveCamera();
 		}
 		frametime = glfwGetTime() - lastTime;
 		lastTime = glfwGetTime();
@@ -166,40 +269,246 @@ int main() {
 	ASSERT(ImageWriter::Write(img), "Image write failed!")
 }
 
-void DisplayObjects(Scene& scene) {
+// RMSE of every sampler at 1, 2, 4 ... 256 samples per pixel against a reference rendered with another seed, on a
+// small image so the reference does not take long
+void RunSamplerBenchmark(Renderer& renderer, const Scene& scene, const Camera& cam, uint32_t referencePasses) {
+	constexpr uint32_t width = 320, height = 180, maxSamples = 256;
+	constexpr const char* names[] = { "Random", "Stratified", "Sobol", "Blue Noise" };
+	Image image(width, height, 4);
+	Camera camera = cam;
+	camera.Resize(width, height);
+	renderer.SetImage(image);
+
+	RenderSettings settings = { .NumberOfSamples = 1, .NumberOfBounces = 5, .Accumulate = true, .Sampling = SamplerType::Sobol, .SamplerSeed = 1 };
+	std::chrono::time_point <std::chrono::high_resolution_clock> start, end;
+	start = std::chrono::high_resolution_clock::now();
+	renderer.SetSettings(RenderSettings(settings));
+	renderer.RenderPasses(scene, camera, referencePasses);
+	std::vector<glm::vec3> reference = renderer.GetAccumulation();
+	end = std::chrono::high_resolution_clock::now();
+	printf("Rendered the reference (%u samples) in %" PRId64 "ms\n", referencePasses,
+			(int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+
+	std::vector<float> errors[4];
+	for (int type = 0; type < 4; type++) {
+		settings.Sampling = (SamplerType)type;
+		settings.SamplerSeed = 0;
+		renderer.CancelRender();
+		renderer.SetSettings(RenderSettings(settings));
+		for (uint32_t samples = 1, rendered = 0; samples <= maxSamples; samples *= 2) {
+			renderer.RenderPasses(scene, camera, samples - rendered);
+			rendered = samples;
+			std::vector<glm::vec3> accumulation = renderer.GetAccumulation();
+			double squaredError = 0.0;
+			for (size_t i = 0; i < accumulation.size(); i++) {
+				glm::vec3 difference = accumulation[i] - reference[i];
+				squaredError += glm::dot(difference, difference);
+			}
+			errors[type].push_back((float)std::sqrt(squaredError / (accumulation.size() * 3.0)));
+		}
+	}
+
+	printf("%8s", "spp");
+	for (const char* name : names)
+		printf("%12s", name);
+	printf("\n");
+	for (uint32_t row = 0, samples = 1; samples <= maxSamples; row++, samples *= 2) {
+		printf("%8u", samples);
+		for (int type = 0; type < 4; type++)
+			printf("%12.5f", errors[type][row]);
+		printf("\n");
+	}
+}
+
+// A budget of 1us runs out before the first tile is done, every frame still has to trace some tiles so the passes
+// go on completing
+bool RunFrameBudgetCheck(Renderer& renderer, const Scene& scene, const Camera& cam) {
+	constexpr uint32_t width = 320, height = 180, passes = 4;
+	Image image(width, height, 4);
+	Camera camera = cam;
+	camera.Resize(width, height);
+	renderer.SetImage(image);
+	renderer.SetSettings({ .NumberOfSamples = 1, .NumberOfBounces = 5, .Accumulate = true, .FrameBudget = 0.001f });
+
+	auto start = std::chrono::high_resolution_clock::now();
+	while (renderer.GetFrameIndex() <= passes && std::chrono::high_resolution_clock::now() - start < std::chrono::seconds(30)) {
+		renderer.Render(scene, camera);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	uint32_t completed = renderer.GetFrameIndex() - 1;
+	renderer.CancelRender();
+
+	int64_t duration = (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("Completed %u of %u passes with a 1us frame budget in %" PRId64 "ms\n", completed, passes, duration);
+	return completed >= passes;
+}
+
+// Every kernel the CPU runs against IntersectTriangle, leaf by leaf, on random rays through a soup of random
+// triangles, fans sharing edges and degenerate ones. Hits have to agree exactly, distance included.
+bool RunTriangleKernelCheck(uint32_t rayCount) {
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+	auto randomPoint = [&] { return glm::vec3(uniform(rng), uniform(rng), uniform(rng)); };
+
+	std::vector<glm::vec3> triangles; // three vertices each
+	for (int i = 0; i < 2000; i++) {
+		glm::vec3 v0 = randomPoint(), v1 = v0 + randomPoint() * 0.2f, v2 = v0 + randomPoint() * 0.2f;
+		triangles.insert(triangles.end(), { v0, v1, v2 });
+	}
+	for (int i = 0; i < 200; i++) {
+		// fan of 6 around a centre, each triangle shares two edges with its neighbours
+		glm::vec3 centre = randomPoint(), a = randomPoint() * 0.2f, b = randomPoint() * 0.2f;
+		for (int k = 0; k < 6; k++) {
+			float angle0 = k * Pi / 3.0f, angle1 = (k + 1) * Pi / 3.0f;
+			triangles.insert(triangles.end(), { centre, centre + a * std::cos(angle0) + b * std::sin(angle0),
+					centre + a * std::cos(angle1) + b * std::sin(angle1) });
+		}
+	}
+	for (int i = 0; i < 200; i++) {
+		// a point and a line, two equal vertices or three on a line
+		glm::vec3 v0 = randomPoint(), d = randomPoint() * 0.2f;
+		if (i % 2)
+			triangles.insert(triangles.end(), { v0, v0, v0 + d });
+		else
+			triangles.insert(triangles.end(), { v0, v0 + d, v0 + d * 2.0f });
+	}
+	const uint32_t triangleCount = (uint32_t)triangles.size() / 3;
+	std::vector<Bounds3f> bounds;
+	for (uint32_t t = 0; t < triangleCount; t++)
+		bounds.push_back(Union(Bounds3f(triangles[3 * t], triangles[3 * t + 1]), triangles[3 * t + 2]));
+
+	// a third of the rays are aimed at a vertex or an edge, where the kernels are most likely to disagree
+	std::vector<Ray> rays;
+	for (uint32_t i = 0; i < rayCount; i++) {
+		glm::vec3 origin = randomPoint() * 2.0f, target = randomPoint();
+		uint32_t t = rng() % triangleCount;
+		if (i % 3 == 1)
+			target = triangles[3 * t + rng() % 3];
+		else if (i % 3 == 2)
+			target = (triangles[3 * t] + triangles[3 * t + 1 + rng() % 2]) * 0.5f;
+		rays.push_back(Ray(origin, glm::normalize(target - origin)));
+	}
+
+	const Simd::CPUFeatures& features = Simd::GetCPUFeatures();
+	const char* names[] = { "Scalar", "SSE4.1", "AVX2" };
+	bool supported[] = { true, features.SSE41, features.AVX2 };
+	bool passed = true;
+	for (int kernel = 0; kernel < 3; kernel++) {
+		if (!supported[kernel]) {
+			printf("%-8s not supported by this CPU\n", names[kernel]);
+			continue;
+		}
+
+		BVH bvh;
+		bvh.Build(bounds, BVHBuildMode::SAH, 0, TriangleData::GetPacketWidth((TriangleKernel)kernel));
+		TriangleData data;
+		data.Build(bvh, [&](uint32_t t, glm::vec3 v[3]) {
+				for (int k = 0; k < 3; k++)
+					v[k] = triangles[3 * t + k];
+				}, (TriangleKernel)kernel);
+
+		uint64_t tests = 0, hits = 0, mismatches = 0;
+		const float tMin = 1e-4f, tMax = std::numeric_limits<float>::max();
+		for (const Ray& ray : rays) {
+			const TriangleRay triangleRay(ray);
+			// an any hit traversal that never stops visits every leaf the ray passes through
+			bvh.Occluded(ray, tMin, tMax, [&](uint32_t first, uint32_t count, float, float) {
+					// the closest hit search of the leaf, with the scalar test
+					float closest = tMax, expected = 0.0f;
+					bool expectedHit = false;
+					for (uint32_t i = 0; i < count; i++) {
+						uint32_t t = bvh.PrimitiveIndices[first + i];
+						float distance;
+						if (IntersectTriangle(triangleRay, triangles[3 * t], triangles[3 * t + 1], triangles[3 * t + 2], distance)
+								&& distance > tMin && distance < closest) {
+							closest = expected = distance;
+							expectedHit = true;
+						}
+					}
+
+					float distance = 0.0f;
+					bool hit = data.IntersectLeaf(triangleRay, first, count, tMin, tMax, distance);
+					bool occluded = data.OccludedLeaf(triangleRay, first, count, tMin, tMax);
+					tests++;
+					hits += expectedHit;
+					if (hit != expectedHit || occluded != expectedHit || (hit && distance != expected))
+						mismatches++;
+					return false;
+					});
+		}
+		printf("%-8s %" PRIu64 " leaf tests, %" PRIu64 " hits, %" PRIu64 " mismatches\n", names[kernel], tests, hits, mismatches);
+		passed &= mismatches == 0;
+	}
+	return passed;
+}
+
+// The CPU renderer reads the geometry from its own thread, so widgets edit a copy that is written back once the
+// renderer is stopped
+void DisplayObjects(Scene& scene, Renderer& renderer) {
 	ImGui::Begin("Objects");
 	int i = 0;
 	for (auto& object : scene.Objects) {
 		char label[32];
 		sprintf(label, "Object %d", i);
 		if (ImGui::BeginMenu(label)) {
-			ImGui::SliderFloat3("Position", &object->Origin.x, -10.0f, 10.0f);
+			glm::vec3 origin = object->Origin;
+			if (ImGui::SliderFloat3("Position", &origin.x, -10.0f, 10.0f)) {
+				renderer.CancelRender();
+				object->Origin = origin;
+			}
 			if (object->GetType() == ObjectType::Sphere) {
 				auto sphere = dynamic_cast<Sphere*>(object);
-				ImGui::SliderFloat("Radius", &sphere->Radius, 0.0f, 10.0f);
+				float radius = sphere->Radius;
+				if (ImGui::SliderFloat("Radius", &radius, 0.0f, 10.0f)) {
+					renderer.CancelRender();
+					sphere->Radius = radius;
+				}
 			}
 			if (object->GetType() == ObjectType::Triangle) {
 				auto triangle = dynamic_cast<Triangle*>(object);
-				ImGui::SliderFloat3("Vertex 1", &triangle->Vertices[0].x, -10.0f, 10.0f);
-				ImGui::SliderFloat3("Vertex 2", &triangle->Vertices[1].x, -10.0f, 10.0f);
-				ImGui::SliderFloat3("Vertex 3", &triangle->Vertices[2].x, -10.0f, 10.0f);
+				glm::vec3 vertices[3] = { triangle->Vertices[0], triangle->Vertices[1], triangle->Vertices[2] };
+				bool edited = ImGui::SliderFloat3("Vertex 1", &vertices[0].x, -10.0f, 10.0f);
+				edited |= ImGui::SliderFloat3("Vertex 2", &vertices[1].x, -10.0f, 10.0f);
+				edited |= ImGui::SliderFloat3("Vertex 3", &vertices[2].x, -10.0f, 10.0f);
+				if (edited) {
+					renderer.CancelRender();
+					for (int k = 0; k < 3; k++)
+						triangle->Vertices[k] = vertices[k];
+					triangle->Recalculate();
+				}
 			}
 			if (object->GetType() == ObjectType::Mesh) {
 				auto mesh = dynamic_cast<Mesh*>(object);
 				static glm::vec3 newOrigin;
 				ImGui::SliderFloat3("Adjust Position", &newOrigin.x, -100.0f, 100.0f);
 				if (ImGui::Button("Update Mesh Position")) {
+					renderer.CancelRender();
 					mesh->MoveTo(newOrigin);
 				}
-				int j = 0;
-				for (auto& tri : mesh->MeshTriangles) {
+				ImGui::SliderFloat("BVH Rebuild Threshold", &mesh->RefitCostThreshold, 1.0f, 4.0f);
+				for (int j = 0; j < (int)mesh->GetTriangleCount(); j++) {
+					MeshTriangle tri = mesh->GetTriangle(j);
 					ImGui::PushID(j);
 					char label2[32];
-					sprintf(label2, "Triangle %d", j++);
+					sprintf(label2, "Triangle %d", j);
 					ImGui::SeparatorText(label2);
-					ImGui::SliderFloat3("Vertex 1", &tri.Vertices[0].x, -10.0f, 10.0f);
-					ImGui::SliderFloat3("Vertex 2", &tri.Vertices[1].x, -10.0f, 10.0f);
-					ImGui::SliderFloat3("Vertex 3", &tri.Vertices[2].x, -10.0f, 10.0f);
+					// vertices are shared, editing one moves every triangle using it
+					// rebuild with the fast linear builder while dragging, full SAH once released
+					for (int k = 0; k < 3; k++) {
+						char vertexLabel[16];
+						sprintf(vertexLabel, "Vertex %d", k + 1);
+						uint32_t vertex = tri.Index[k];
+						glm::vec3 position = mesh->Vertices[vertex];
+						if (ImGui::SliderFloat3(vertexLabel, &position.x, -10.0f, 10.0f)) {
+							renderer.CancelRender();
+							mesh->Vertices[vertex] = position;
+							mesh->UpdateVertex(vertex, BVHBuildMode::Linear);
+						}
+						if (ImGui::IsItemDeactivatedAfterEdit()) {
+							renderer.CancelRender();
+							mesh->UpdateVertex(vertex, BVHBuildMode::SAH);
+						}
+					}
 					ImGui::PopID();
 				}
 			}
@@ -210,21 +519,26 @@ void DisplayObjects(Scene& scene) {
 	ImGui::End();
 }
 
-void DisplayMaterials(Scene& scene) {
+// True if a material was edited
+bool DisplayMaterials(Scene& scene) {
 	ImGui::Begin("Materials");
+	bool edited = false;
 	int i = 0;
 	for (auto& material : scene.Materials) {
 		char label[32];
 		sprintf(label, "Material %d", i);
 		if (ImGui::BeginMenu(label)) {
-			ImGui::ColorEdit3("Albedo", &material.Albedo.x);
-			ImGui::SliderFloat("Roughness", &material.Roughness, 0.0f, 1.0f);
-			ImGui::SliderFloat("Metallic", &material.Metallic, 0.0f, 1.0f);
-			ImGui::ColorEdit3("Emission Color", &material.EmissionColor.x);
-			ImGui::SliderFloat("Emission Strength", &material.EmissionStrength, 0.0f, 1.0f);
+			edited |= ImGui::ColorEdit3("Albedo", &material.Albedo.x);
+			edited |= ImGui::SliderFloat("Roughness", &material.Roughness, 0.0f, 1.0f);
+			edited |= ImGui::SliderFloat("Metallic", &material.Metallic, 0.0f, 1.0f);
+			edited |= ImGui::SliderFloat("Transmission", &material.Transmission, 0.0f, 1.0f);
+			edited |= ImGui::SliderFloat("IOR", &material.IOR, 1.0f, 2.5f);
+			edited |= ImGui::ColorEdit3("Emission Color", &material.EmissionColor.x);
+			edited |= ImGui::SliderFloat("Emission Strength", &material.EmissionStrength, 0.0f, 1.0f);
 			ImGui::EndMenu();
 		}
 		i++;
 	}
 	ImGui::End();
+	return edited;
 }
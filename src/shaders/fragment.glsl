@@ -15,6 +15,11 @@ uniform int MeshCount;
 uniform float Time; // For random seed
 uniform int FrameIndex;
 uniform int Accumulate;
+uniform int LightCount;
+uniform int NextEventEstimation;
+uniform int LightWeighting; // MISHeuristic: 0 none, 1 balance, 2 power
+uniform float LightTotalPower;
+uniform int RussianRouletteDepth;
 
 // Accumulation texture for progressive rendering
 layout(rgba32f, binding = 0) uniform image2D AccumulationTexture;
@@ -42,7 +47,17 @@ struct Material {
 	vec3 emissionColor;
 	float emissionStrength;
 	float metallic;
-	float padding[3];  // Add padding for alignment
+	float transmission;
+	float ior;
+	float padding;  // Add padding for alignment
+};
+
+// CPU to GPU struct, an emissive triangle and its slot of the alias table over the light power
+struct Light {
+	int triangleIndex;
+	int alias;
+	float probability; // of keeping this slot rather than taking its alias
+	float pdf; // of picking this light
 };
 
 struct Ray {
@@ -69,9 +84,22 @@ layout(std430, binding = 2) buffer MaterialsBuffer {
 	Material Materials[];
 };
 
+layout(std430, binding = 3) buffer LightsBuffer {
+	Light Lights[];
+};
+
 // Function prototypes
 Ray GenerateRay();
 HitPayload TraceRay(Ray r);
+// Scattering at a hit, the lobes of Bsdf.h
+struct Bsdf {
+	vec3 normal, tangent, bitangent; // normal faces wo
+	vec3 albedo;
+	float alpha;
+	float eta;
+	float diffuse, conductor, dielectric;
+};
+
 bool TriangleHit(Ray r, Triangle tri, float tMin, float tMax, out float hitDist);
 bool AABBHit(Ray r, vec3 minBounds, vec3 maxBounds, float tMin, float tMax, out float hitDist);
 HitPayload Miss(Ray r);
@@ -79,6 +107,13 @@ vec3 RandomVector(vec2 uv);
 uint pcg_hash(uint seed);
 float RandomFloat(inout uint state);
 vec3 RandomInUnitSphere(inout uint state);
+Bsdf MakeBsdf(Material material, vec3 normal, bool frontFace);
+vec3 BsdfEvaluate(Bsdf bsdf, vec3 wo, vec3 wi);
+float BsdfPdf(Bsdf bsdf, vec3 wo, vec3 wi);
+bool BsdfSample(Bsdf bsdf, vec3 wo, inout uint state, out vec3 value, out vec3 wi, out float pdf, out bool specular);
+float MisWeight(float pdf, float otherPdf);
+float Luminance(vec3 color);
+vec3 SampleDirectLight(vec3 position, vec3 wo, Bsdf bsdf, inout uint state);
 
 void main() {
 	// Initialize RNG state based on fragment coordinate and time
@@ -93,6 +128,10 @@ void main() {
 	for (int s = 0; s < NumberOfSamples; s++) {
 		vec3 throughput = vec3(1.0);  // Light attenuation
 		Ray ray = GenerateRay();
+		// false after a bounce that sampled a light, which already counted what the next hit emits
+		bool countEmission = true;
+		// density the ray was scattered with, lights it hits are weighted against light sampling. 0 counts them fully.
+		float bsdfPdf = 0.0;
 
 		for (int b = 0; b < NumberOfBounces + 1; b++) {
 			HitPayload payload = TraceRay(ray);
@@ -113,38 +152,56 @@ void main() {
 				material.emissionColor = vec3(0.0);
 				material.emissionStrength = 0.0;
 				material.metallic = 0.0;
+				material.transmission = 0.0;
+				material.ior = 1.5;
 			}
 
-			// Handle light emission
-			finalColor += throughput * material.emissionColor * material.emissionStrength;
-
-			// Update throughput with material albedo
-			throughput *= material.albedo;
-
-			// Early termination (matching CPU behavior)
-			if (length(throughput) < 0.01 && b > 2) {
-				break;
+			// Handle light emission, every emissive triangle is in the light list
+			vec3 emission = material.emissionColor * material.emissionStrength;
+			if (bsdfPdf > 0.0 && LightTotalPower > 0.0) {
+				float cosLight = abs(dot(normalize(payload.worldNormal), ray.direction));
+				float lightPdf = Luminance(emission) * payload.hitDistance * payload.hitDistance / max(cosLight * LightTotalPower, 1e-12);
+				finalColor += throughput * emission * MisWeight(bsdfPdf, lightPdf);
+			} else if (countEmission) {
+				finalColor += throughput * emission;
 			}
 
-			// Prepare for next bounce
-			vec3 normal = normalize(payload.worldNormal);
-
-			// Calculate new ray direction based on material properties
-			vec3 reflectDir = reflect(ray.direction, normal);
-			vec3 diffuseDir = normalize(normal + RandomInUnitSphere(state));
-
-			// Use metallic to choose between reflection and diffuse
-			vec3 newDir;
-			if (RandomFloat(state) < material.metallic) {
-				// Reflective path with roughness perturbation
-				newDir = normalize(mix(reflectDir, normalize(reflectDir + material.roughness * RandomInUnitSphere(state)), material.roughness));
-			} else {
-				// Diffuse path
-				newDir = diffuseDir;
+			// Russian roulette (matching CPU behavior), survivors make up for the paths ended
+			if (b >= RussianRouletteDepth) {
+				float survival = min(max(throughput.x, max(throughput.y, throughput.z)), 1.0);
+				if (RandomFloat(state) >= survival)
+					break;
+				throughput /= survival;
 			}
 
-			// Set up new ray for next bounce
-			ray.origin = payload.worldPosition + normal * 0.001; // Offset to avoid self-intersection
+			// Prepare for next bounce, the BSDF works with the normal facing the ray
+			vec3 normal = normalize(payload.worldNormal);
+			bool frontFace = dot(normal, ray.direction) < 0.0;
+			if (!frontFace)
+				normal = -normal;
+			vec3 wo = -ray.direction;
+			Bsdf bsdf = MakeBsdf(material, normal, frontFace);
+			bool specular = bsdf.diffuse == 0.0 && bsdf.alpha < 1e-3;
+
+			bool sampleLights = NextEventEstimation == 1 && LightCount > 0 && !specular;
+			bool weighted = sampleLights && LightWeighting != 0;
+			if (sampleLights)
+				finalColor += throughput * SampleDirectLight(payload.worldPosition, wo, bsdf, state);
+
+			// Pick a lobe and a direction from it, like Renderer::Shade
+			vec3 value, newDir;
+			float pdf;
+			bool specularSample;
+			if (!BsdfSample(bsdf, wo, state, value, newDir, pdf, specularSample))
+				break; // absorbed
+			float cosTheta = dot(newDir, normal);
+			throughput *= value * (abs(cosTheta) / pdf);
+			// light sampling cannot find what is behind a smooth reflection or refraction
+			countEmission = !sampleLights || specularSample;
+			bsdfPdf = weighted && !specularSample ? pdf : 0.0;
+
+			// Set up new ray for next bounce, leaving from the side it goes to
+			ray.origin = payload.worldPosition + normal * (cosTheta > 0.0 ? 0.001 : -0.001);
 			ray.direction = newDir;
 		}
 	}
@@ -302,3 +359,294 @@ vec3 RandomInUnitSphere(inout uint state) {
 	float y = r * sin(t);
 	return vec3(x, y, z);
 }
+
+// GGX (Trowbridge-Reitz) microfacets and Fresnel, the same functions as Bsdf.cpp, in the local frame
+float GGXDistribution(vec3 wm, float alpha) {
+	float cos2Theta = wm.z * wm.z;
+	float cos4Theta = cos2Theta * cos2Theta;
+	if (cos4Theta < 1e-16)
+		return 0.0;
+	float e = (1.0 - cos2Theta) / cos2Theta / (alpha * alpha);
+	return 1.0 / (3.14159265 * alpha * alpha * cos4Theta * (1.0 + e) * (1.0 + e));
+}
+
+float GGXLambda(vec3 w, float alpha) {
+	float cos2Theta = w.z * w.z;
+	if (cos2Theta < 1e-16)
+		return 0.0;
+	float tan2Theta = (1.0 - cos2Theta) / cos2Theta;
+	return (sqrt(1.0 + alpha * alpha * tan2Theta) - 1.0) / 2.0;
+}
+
+float GGXMaskingShadowing(vec3 wo, vec3 wi, float alpha) {
+	return 1.0 / (1.0 + GGXLambda(wo, alpha) + GGXLambda(wi, alpha));
+}
+
+float GGXVisiblePdf(vec3 w, vec3 wm, float alpha) {
+	return GGXDistribution(wm, alpha) * abs(dot(w, wm)) / ((1.0 + GGXLambda(w, alpha)) * abs(w.z));
+}
+
+// A normal visible from w (Heitz 2018)
+vec3 SampleGGXVisible(vec3 w, float alpha, vec2 u) {
+	vec3 wh = normalize(vec3(alpha * w.x, alpha * w.y, w.z));
+	if (wh.z < 0.0)
+		wh = -wh;
+	vec3 t1 = wh.z < 0.99999 ? normalize(cross(vec3(0.0, 0.0, 1.0), wh)) : vec3(1.0, 0.0, 0.0);
+	vec3 t2 = cross(wh, t1);
+	float r = sqrt(u.x);
+	float phi = 2.0 * 3.14159265 * u.y;
+	vec2 p = vec2(r * cos(phi), r * sin(phi));
+	float h = sqrt(1.0 - p.x * p.x);
+	float s = (1.0 + wh.z) / 2.0;
+	p.y = (1.0 - s) * h + s * p.y;
+	float pz = sqrt(max(0.0, 1.0 - dot(p, p)));
+	vec3 nh = p.x * t1 + p.y * t2 + pz * wh;
+	return normalize(vec3(alpha * nh.x, alpha * nh.y, max(1e-6, nh.z)));
+}
+
+float FresnelDielectric(float cosThetaI, float eta) {
+	cosThetaI = clamp(cosThetaI, -1.0, 1.0);
+	if (cosThetaI < 0.0) {
+		eta = 1.0 / eta;
+		cosThetaI = -cosThetaI;
+	}
+	float sin2ThetaT = (1.0 - cosThetaI * cosThetaI) / (eta * eta);
+	if (sin2ThetaT >= 1.0)
+		return 1.0; // total internal reflection
+	float cosThetaT = sqrt(1.0 - sin2ThetaT);
+	float parallel = (eta * cosThetaI - cosThetaT) / (eta * cosThetaI + cosThetaT);
+	float perpendicular = (cosThetaI - eta * cosThetaT) / (cosThetaI + eta * cosThetaT);
+	return (parallel * parallel + perpendicular * perpendicular) / 2.0;
+}
+
+vec3 FresnelSchlick(vec3 f0, float cosTheta) {
+	float m = 1.0 - clamp(cosTheta, 0.0, 1.0);
+	return f0 + (vec3(1.0) - f0) * (m * m * m * m * m);
+}
+
+bool RefractLocal(vec3 wo, vec3 n, float eta, out vec3 wt) {
+	float cosThetaI = dot(n, wo);
+	float sin2ThetaT = max(0.0, 1.0 - cosThetaI * cosThetaI) / (eta * eta);
+	wt = vec3(0.0);
+	if (sin2ThetaT >= 1.0)
+		return false;
+	float cosThetaT = sqrt(1.0 - sin2ThetaT);
+	wt = -wo / eta + (cosThetaI / eta - cosThetaT) * n;
+	return true;
+}
+
+bool DielectricHalfVector(vec3 wo, vec3 wi, float eta, out vec3 wm) {
+	wm = wi * (wi.z > 0.0 ? 1.0 : eta) + wo;
+	if (wi.z == 0.0 || dot(wm, wm) == 0.0)
+		return false;
+	wm = normalize(wm);
+	if (wm.z < 0.0)
+		wm = -wm;
+	return dot(wm, wi) * wi.z >= 0.0 && dot(wm, wo) * wo.z >= 0.0;
+}
+
+Bsdf MakeBsdf(Material material, vec3 normal, bool frontFace) {
+	Bsdf bsdf;
+	bsdf.normal = normal;
+	// Duff et al. 2017, sign() is 0 at 0
+	float sgn = normal.z >= 0.0 ? 1.0 : -1.0;
+	float a = -1.0 / (sgn + normal.z);
+	float b = normal.x * normal.y * a;
+	bsdf.tangent = vec3(1.0 + sgn * normal.x * normal.x * a, sgn * b, -sgn * normal.x);
+	bsdf.bitangent = vec3(b, sgn + normal.y * normal.y * a, -normal.y);
+	bsdf.albedo = material.albedo;
+	float roughness = clamp(material.roughness, 0.0, 1.0);
+	bsdf.alpha = roughness * roughness;
+	bsdf.eta = frontFace ? material.ior : 1.0 / material.ior;
+	float metallic = clamp(material.metallic, 0.0, 1.0);
+	float transmission = clamp(material.transmission, 0.0, 1.0);
+	bsdf.conductor = metallic;
+	bsdf.dielectric = (1.0 - metallic) * transmission;
+	bsdf.diffuse = (1.0 - metallic) * (1.0 - transmission);
+	return bsdf;
+}
+
+vec3 BsdfToLocal(Bsdf bsdf, vec3 v) {
+	return vec3(dot(v, bsdf.tangent), dot(v, bsdf.bitangent), dot(v, bsdf.normal));
+}
+
+vec3 BsdfEvaluateLocal(Bsdf bsdf, vec3 wo, vec3 wi) {
+	if (wo.z <= 0.0)
+		return vec3(0.0);
+	vec3 f = vec3(0.0);
+	bool reflected = wi.z > 0.0;
+	if (bsdf.diffuse > 0.0 && reflected)
+		f += bsdf.diffuse * bsdf.albedo / 3.14159265;
+	if (bsdf.alpha < 1e-3)
+		return f;
+
+	if (bsdf.conductor > 0.0 && reflected) {
+		vec3 wm = normalize(wo + wi);
+		f += bsdf.conductor * GGXDistribution(wm, bsdf.alpha) * GGXMaskingShadowing(wo, wi, bsdf.alpha) / (4.0 * wo.z * wi.z)
+			* FresnelSchlick(bsdf.albedo, dot(wo, wm));
+	}
+	vec3 wm;
+	if (bsdf.dielectric > 0.0 && DielectricHalfVector(wo, wi, bsdf.eta, wm)) {
+		float fresnel = FresnelDielectric(dot(wo, wm), bsdf.eta);
+		float dg = GGXDistribution(wm, bsdf.alpha) * GGXMaskingShadowing(wo, wi, bsdf.alpha);
+		if (reflected) {
+			f += vec3(bsdf.dielectric * dg * fresnel / (4.0 * wo.z * wi.z));
+		} else {
+			float denominator = dot(wi, wm) + dot(wo, wm) / bsdf.eta;
+			denominator *= denominator * wi.z * wo.z;
+			float transmitted = dg * (1.0 - fresnel) * abs(dot(wi, wm) * dot(wo, wm) / denominator) / (bsdf.eta * bsdf.eta);
+			f += bsdf.dielectric * transmitted * bsdf.albedo;
+		}
+	}
+	return f;
+}
+
+float BsdfPdfLocal(Bsdf bsdf, vec3 wo, vec3 wi) {
+	if (wo.z <= 0.0)
+		return 0.0;
+	float pdf = 0.0;
+	bool reflected = wi.z > 0.0;
+	if (bsdf.diffuse > 0.0 && reflected)
+		pdf += bsdf.diffuse * wi.z / 3.14159265;
+	if (bsdf.alpha < 1e-3)
+		return pdf;
+
+	if (bsdf.conductor > 0.0 && reflected) {
+		vec3 wm = normalize(wo + wi);
+		pdf += bsdf.conductor * GGXVisiblePdf(wo, wm, bsdf.alpha) / (4.0 * abs(dot(wo, wm)));
+	}
+	vec3 wm;
+	if (bsdf.dielectric > 0.0 && DielectricHalfVector(wo, wi, bsdf.eta, wm)) {
+		float fresnel = FresnelDielectric(dot(wo, wm), bsdf.eta);
+		if (reflected) {
+			pdf += bsdf.dielectric * fresnel * GGXVisiblePdf(wo, wm, bsdf.alpha) / (4.0 * abs(dot(wo, wm)));
+		} else {
+			float denominator = dot(wi, wm) + dot(wo, wm) / bsdf.eta;
+			pdf += bsdf.dielectric * (1.0 - fresnel) * GGXVisiblePdf(wo, wm, bsdf.alpha) * abs(dot(wi, wm)) / (denominator * denominator);
+		}
+	}
+	return pdf;
+}
+
+vec3 BsdfEvaluate(Bsdf bsdf, vec3 wo, vec3 wi) {
+	return BsdfEvaluateLocal(bsdf, BsdfToLocal(bsdf, wo), BsdfToLocal(bsdf, wi));
+}
+
+float BsdfPdf(Bsdf bsdf, vec3 wo, vec3 wi) {
+	return BsdfPdfLocal(bsdf, BsdfToLocal(bsdf, wo), BsdfToLocal(bsdf, wi));
+}
+
+// Same lobe choice as Bsdf::Sample, specular samples carry the probability of their lobe as pdf
+bool BsdfSample(Bsdf bsdf, vec3 worldWo, inout uint state, out vec3 value, out vec3 wi, out float pdf, out bool specular) {
+	vec3 wo = BsdfToLocal(bsdf, worldWo);
+	value = vec3(0.0);
+	wi = vec3(0.0);
+	pdf = 0.0;
+	specular = false;
+	if (wo.z <= 0.0)
+		return false;
+
+	float uLobe = RandomFloat(state);
+	vec2 u = vec2(RandomFloat(state), RandomFloat(state));
+	bool isSmooth = bsdf.alpha < 1e-3;
+	if (uLobe < bsdf.diffuse) {
+		float r = sqrt(u.x);
+		float phi = 2.0 * 3.14159265 * u.y;
+		wi = vec3(r * cos(phi), r * sin(phi), sqrt(max(0.0, 1.0 - u.x)));
+	} else if (uLobe < bsdf.diffuse + bsdf.conductor || bsdf.dielectric == 0.0) {
+		if (isSmooth) {
+			wi = vec3(-wo.x, -wo.y, wo.z);
+			value = bsdf.conductor * FresnelSchlick(bsdf.albedo, wo.z) / wi.z;
+			pdf = bsdf.conductor;
+			specular = true;
+		} else {
+			vec3 wm = SampleGGXVisible(wo, bsdf.alpha, u);
+			wi = reflect(-wo, wm);
+			if (wi.z <= 0.0)
+				return false;
+		}
+	} else {
+		// what is left of uLobe chooses between reflection and refraction
+		float uFresnel = min((uLobe - bsdf.diffuse - bsdf.conductor) / bsdf.dielectric, 0.99999994);
+		if (isSmooth) {
+			float fresnel = FresnelDielectric(wo.z, bsdf.eta);
+			specular = true;
+			if (uFresnel < fresnel) {
+				wi = vec3(-wo.x, -wo.y, wo.z);
+				value = vec3(bsdf.dielectric * fresnel / wi.z);
+				pdf = bsdf.dielectric * fresnel;
+			} else {
+				if (!RefractLocal(wo, vec3(0.0, 0.0, 1.0), bsdf.eta, wi))
+					return false;
+				value = bsdf.dielectric * (1.0 - fresnel) / abs(wi.z) / (bsdf.eta * bsdf.eta) * bsdf.albedo;
+				pdf = bsdf.dielectric * (1.0 - fresnel);
+			}
+		} else {
+			vec3 wm = SampleGGXVisible(wo, bsdf.alpha, u);
+			if (uFresnel < FresnelDielectric(dot(wo, wm), bsdf.eta)) {
+				wi = reflect(-wo, wm);
+				if (wi.z <= 0.0)
+					return false;
+			} else if (!RefractLocal(wo, wm, bsdf.eta, wi) || wi.z >= 0.0) {
+				return false;
+			}
+		}
+	}
+
+	if (!specular) {
+		value = BsdfEvaluateLocal(bsdf, wo, wi);
+		pdf = BsdfPdfLocal(bsdf, wo, wi);
+	}
+	wi = bsdf.tangent * wi.x + bsdf.bitangent * wi.y + bsdf.normal * wi.z;
+	return pdf > 0.0;
+}
+
+float MisWeight(float pdf, float otherPdf) {
+	if (LightWeighting == 2) {
+		pdf *= pdf;
+		otherPdf *= otherPdf;
+	}
+	return pdf / (pdf + otherPdf);
+}
+
+float Luminance(vec3 color) {
+	return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Light from an emissive triangle picked by power, scattered by bsdf towards wo.
+// Same estimator as Renderer::SampleDirectLight.
+vec3 SampleDirectLight(vec3 position, vec3 wo, Bsdf bsdf, inout uint state) {
+	float scaled = RandomFloat(state) * float(LightCount);
+	int slot = min(int(scaled), LightCount - 1);
+	Light light = Lights[slot];
+	if (scaled - float(slot) >= light.probability)
+		light = Lights[light.alias];
+
+	// uniform over the triangle's area
+	Triangle tri = Triangles[light.triangleIndex];
+	float su = sqrt(RandomFloat(state));
+	float v = RandomFloat(state);
+	vec3 point = tri.v0.xyz * (1.0 - su) + tri.v1.xyz * (su * (1.0 - v)) + tri.v2.xyz * (su * v);
+
+	vec3 toLight = point - position;
+	float distanceSquared = dot(toLight, toLight);
+	float dist = sqrt(distanceSquared);
+	vec3 dir = toLight / dist;
+	vec3 areaNormal = cross(tri.v1.xyz - tri.v0.xyz, tri.v2.xyz - tri.v0.xyz);
+	float area = 0.5 * length(areaNormal);
+	float cosLight = abs(dot(areaNormal, dir)) / (2.0 * area);
+	vec3 f = BsdfEvaluate(bsdf, wo, dir);
+	if (f == vec3(0.0) || cosLight <= 1e-6)
+		return vec3(0.0);
+
+	// stop just short of the light, so it does not shadow itself
+	float cosTheta = dot(bsdf.normal, dir);
+	HitPayload blocker = TraceRay(Ray(position + bsdf.normal * (cosTheta > 0.0 ? 0.001 : -0.001), dir));
+	if (blocker.hitDistance > 0.0 && blocker.hitDistance < dist * 0.999)
+		return vec3(0.0);
+
+	Material material = Materials[tri.materialIndex];
+	float pdf = light.pdf * distanceSquared / (cosLight * area); // per unit solid angle
+	float weight = LightWeighting != 0 ? MisWeight(pdf, BsdfPdf(bsdf, wo, dir)) : 1.0;
+	return material.emissionColor * material.emissionStrength * f * (abs(cosTheta) * weight / pdf);
+}